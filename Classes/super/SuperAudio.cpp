@@ -32,10 +32,23 @@
 
 #include <cstring>
 #include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include "SuperAudio.h"
 #include "SuperAudioUtils.h"
+#include "SuperAudioLockFree.h"
 #include "SuperpoweredSimple.h"
 #include "SuperpoweredAdvancedAudioPlayer.h"
+#include "SuperpoweredReverb.h"
+#include "SuperpoweredFilter.h"
+#include "SuperpoweredCompressor.h"
+#include "SuperpoweredLimiter.h"
+#include "SuperpoweredFFT.h"
 #if CC_TARGET_PLATFORM == CC_PLATFORM_IOS
 #include "SuperpoweredIOSAudioIO.h"
 #endif
@@ -51,21 +64,246 @@
 #include <string>
 #endif
 
-#define MAX_AUDIOINSTANCES 24
+#define DEFAULT_AUDIOINSTANCES 24 // pool capacity if SuperAudio::init() isn't called first
+#define MAX_SENDBUSES 4
+#define EOF_TOLERANCEMS 50 // an EOF is ignored unless the player is this close to its end (sounds are at least 100 ms)
+#define SPECTRUM_LOGSIZE 10 // 1024-point FFT
+#define BOUNCE_BLOCKSIZE 1024 // samples mixed at a time by offline bounces
+#define BOUNCE_BUFFERBYTES (BOUNCE_BLOCKSIZE*2*sizeof(float) + 128) // players write up to 64 bytes past the end
+#define BOUNCE_LOADTIMEOUT 10000 // ms to wait for an offline bounce's files to load, or to decode
+#define CAPTURE_SECONDS 2 // of output the capture ring holds while its writer catches up
+#define CAPTURE_BATCH 16384 // floats per write by the capture thread
+#define WAV_MAXDATABYTES (0xFFFFFFFFu - 58 - 7) // whole stereo float samples that fit in a WAV file's 32-bit sizes
+
+// Debug only: set to 1 to trap (stop in the debugger) on any operator new from the audio
+//   thread, or from inside the play/stop calls below.  Your own callbacks are exempt.
+#ifndef SUPERAUDIO_TRAP_ALLOCATIONS
+#define SUPERAUDIO_TRAP_ALLOCATIONS 0
+#endif
+
+#if SUPERAUDIO_TRAP_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+static thread_local int allocationTrapDepth = 0;
+
+struct AllocationTrap { // traps allocations while in scope
+    AllocationTrap() { allocationTrapDepth++; }
+    ~AllocationTrap() { allocationTrapDepth--; }
+};
+struct AllocationTrapPause { // allows allocations while in scope, such as in user callbacks
+    int depth;
+    AllocationTrapPause() : depth(allocationTrapDepth) { allocationTrapDepth = 0; }
+    ~AllocationTrapPause() { allocationTrapDepth = depth; }
+};
+#define TRAP_ALLOCATIONS AllocationTrap allocationTrap
+#define ALLOW_ALLOCATIONS AllocationTrapPause allocationTrapPause
+
+static void *trappedMalloc(std::size_t size) { // nullptr if out of memory
+    if (allocationTrapDepth > 0) __builtin_trap(); // look at the call stack: this allocation is on the hot path
+    return malloc(size ? size : 1);
+}
+static void *trappedNew(std::size_t size) {
+    auto p = trappedMalloc(size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void *operator new(std::size_t size) { return trappedNew(size); }
+void *operator new[](std::size_t size) { return trappedNew(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return trappedMalloc(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return trappedMalloc(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
+#if __cpp_sized_deallocation
+void operator delete(void *p, std::size_t) noexcept { free(p); }
+void operator delete[](void *p, std::size_t) noexcept { free(p); }
+#endif
+#else
+#define TRAP_ALLOCATIONS
+#define ALLOW_ALLOCATIONS
+#endif
 
 static float *outputBuffer = nullptr;
+static float *voiceBuffer = nullptr; // one voice's output, when it can't be mixed directly into outputBuffer
+static size_t outputBufferBytes = 0;
 static unsigned int lastSamplerate = 44100; // default
 
+enum PlayerEvent { // preallocated event records, one bit per event kind in PlayerInfo
+    PlayerEventLoadSuccess = 1,
+    PlayerEventLoadError = 2,
+    PlayerEventEOF = 4,
+    PlayerEventRampDone = 8 // shifted left by RampParameter
+};
+
+enum RampParameter { // same order as SuperAudio::AudioParameter
+    RampVolume,
+    RampPan,
+    RampRate,
+    RampCount
+};
+static const float rampDefaults[RampCount] = { 0.5f, 0.0f, 1.0f };
+// Ramp::curve for the music's crossfades, which are equal power (sine/cosine) since one end is 0
+static const int RampCrossfade = -1;
+
+// A ramp requested by the Cocos thread, read by the audio thread as a seqlock on its serial,
+//   which is kept in VoicePool::rampRequestSerials so that the audio thread's check for new
+//   requests on every buffer doesn't touch the rest.
+struct RampRequest {
+    std::atomic<float> target;
+    std::atomic<float> seconds;
+    std::atomic<int> curve; // SuperAudio::FadeCurve
+    std::atomic<bool> notify; // post PlayerEventRampDone when finished
+};
+
+// Ramp state of one voice parameter, owned by the audio thread
+struct Ramp {
+    float value; // as of the end of the last buffer
+    float start;
+    float target;
+    unsigned int elapsed; // samples
+    unsigned int duration; // samples
+    int curve; // SuperAudio::FadeCurve
+    unsigned int serial; // of the RampRequest being ramped
+    bool notify;
+    bool active;
+};
+
+struct InstanceLimit {
+    int maxInstances; // 0 if unlimited
+    SuperAudio::InstancePolicy policy;
+};
+static std::map<std::string, InstanceLimit> instanceLimits; // keyed by filePath given to open()
+static unsigned int openCount = 0; // for finding the oldest instance
+
+// Cold per-voice state, only used by the Cocos thread
 struct PlayerInfo {
-    SuperpoweredAdvancedAudioPlayer *player;
     bool nowLoading;
-    std::function<void(int id, bool isSuccess)> callbackWhenloaded;
-    float volume;
+    SuperAudio::OpenCallback callbackWhenloaded;
     bool closeWhenDone;
-    std::function<void()> callbackWhenDone;
-    int id; // same as playerInfo's index
+    SuperAudio::FinishCallback callbackWhenDone;
+    int id; // same as index into VoicePool's arrays
+    const InstanceLimit *limit; // non-null if opened for a sound with an instance limit
+    bool parked; // finished, but kept loaded for the next open() of the same sound
+    unsigned int openOrder; // openCount when opened or last reused
+    std::atomic<unsigned int> pendingEvents; // PlayerEvent bits, set by Superpowered's and the audio threads
+    char loadError[64];
+    float targets[RampCount]; // for getVolume() etc., since the audio thread's values may be mid-ramp
+    SuperAudio::FinishCallback rampCallbacks[RampCount];
+    unsigned int rampSerials[RampCount]; // RampRequest serial that rampCallbacks wait for
+};
+
+// The voice pool, sized by SuperAudio::init().  State read by the audio thread for every
+//   voice on every buffer is kept in separate contiguous arrays (structure of arrays), so the
+//   mixer's loop strides over only the bytes it uses, with cold state kept in PlayerInfo.
+struct VoicePool {
+    int capacity; // 0 if not initialized
+    SuperpoweredAdvancedAudioPlayer **players; // hot: nullptr if voice is not open
+    Ramp *ramps[RampCount]; // hot: indexed by voice
+    std::atomic<unsigned int> *rampRequestSerials; // hot: serial of each RampRequest, odd while being written
+    RampRequest *rampRequests; // cold: indexed by voice*RampCount + RampParameter, like the other ramp arrays
+    std::atomic<unsigned int> *rampCompletedSerials; // serial of each parameter's last finished ramp, written by the audio thread
+    float *volumes, *pans; // hot: ramped values as of this buffer, gathered for computeGains()
+    float *sourceX, *sourceY, *minDistances, *maxDistances, *rolloffs; // hot: set by the Cocos thread
+    float *positional; // hot: 1 if positioned by setSourcePosition(), else 0
+    float *gainsLeft, *gainsRight; // hot: computed by computeGains() for this buffer
+    float *lastGainsLeft, *lastGainsRight; // hot: as of the previous buffer (-1 for a new voice)
+    float *dryLevels, *lastDryLevels; // hot: share of gains sent directly to the output
+    float *sends, *lastSends; // hot: send levels, indexed by bus*capacity + voice
+    std::atomic<float> *meterPeaks, *meterRms; // written by the audio thread if metering
+    std::atomic<unsigned int> *transportSerials; // bumped by the Cocos thread after play, pause, seek or loop changes
+    unsigned int *seenSerials; // audio thread: transportSerials as of the start of this buffer
+    unsigned int *startOffsets; // hot: samples of silence before a voice started by the audio thread this buffer
+    PlayerInfo *info; // cold
+};
+
+// What the audio thread last saw of each voice, published once per buffer so queries
+//   read one consistent copy instead of the player's fields while they're being updated.
+struct VoiceState {
+    double positionMs, durationMs;
+    double audioTime; // audio clock (seconds of output rendered) when published
+    unsigned int transportSerial; // VoicePool::transportSerials as of this state
+    bool open, playing, looping;
+};
+static VoicePool voices;
+static float listenerX = 0, listenerY = 0;
+
+// A send bus: one shared effect, fed by every voice with a send level to it
+struct SendBus {
+    SuperpoweredReverb *reverb; // one of these is non-null
+    SuperpoweredFilter *filter;
+    float *buffer; // sends are mixed here, then processed in place
+    float returnLevel; // of the effect's output, mixed into the output
+};
+static SendBus sendBuses[MAX_SENDBUSES];
+static std::atomic<int> sendBusCount(0); // buses [0, sendBusCount) are ready for the audio thread
+
+// master bus effects, applied to the output after all voices and send buses are mixed
+static SuperpoweredCompressor *masterCompressor = nullptr;
+static SuperpoweredLimiter *masterLimiter = nullptr;
+
+// metering and spectrum analysis for visualizers
+static std::atomic<bool> meteringEnabled(false);
+static std::atomic<float> masterPeak(0), masterRms(0);
+static std::atomic<bool> spectrumEnabled(false); // audio thread writes spectrumTap while true
+static SuperAudioRingBuffer<float> spectrumTap; // mono master output, for spectrumThread
+static SuperAudioSnapshot<float> spectrumBands; // published by spectrumThread
+static std::thread spectrumThread;
+
+// music playlist, on the Cocos thread
+struct MusicTrack {
+    std::string filePath;
+    float crossfade; // seconds
+    bool immediate; // from playMusic(): replace the current track as soon as loaded
+};
+static std::vector<MusicTrack> musicPlaylist;
+static size_t musicNextTrack = 0; // index into musicPlaylist of the next track to prefetch
+static bool musicRepeat = false;
+static size_t musicFailures = 0; // tracks in a row that couldn't be opened or loaded: a whole playlist's worth stops prefetching
+static int musicPrefetchID = -1; // opened, waiting for LoadSuccess
+static unsigned int musicPrefetchOrder; // its PlayerInfo::openOrder, in case it's closed meanwhile
+static MusicTrack musicPrefetchTrack;
+static int musicArmedID = -1; // handed to the audio thread as musicNext
+static MusicTrack musicArmedTrack;
+static float musicArmedStopFade = -1; // seconds, if stopMusic() was called while the audio thread was starting it
+static int musicObservedID = -1; // musicCurrent as of the last frame
+struct MusicOutgoing {
+    int id;
+    unsigned int openOrder;
+    double closeAt; // audio clock
+};
+static std::vector<MusicOutgoing> musicOutgoing; // replaced mid-track, closed once faded out
+
+// music transitions, shared with the audio thread
+static std::atomic<int> musicCurrent(-1); // written by the audio thread, except by stopMusic()
+static std::atomic<int> musicNext(-1); // loaded and paused, for the audio thread to start
+static std::atomic<float> musicCrossfade(0); // seconds, for musicNext
+static std::atomic<bool> musicImmediate(false); // for musicNext
+static std::atomic<float> musicVolume(0.5f);
+
+// capture of the output to a file
+static std::atomic<bool> capturing(false); // audio thread writes captureRing while true
+static SuperAudioRingBuffer<float> captureRing; // interleaved stereo output, for captureThread
+static std::atomic<unsigned int> captureOverflows(0); // stereo samples dropped because captureRing was full
+static std::thread captureThread;
+static FILE *captureFile = nullptr;
+static bool captureIsWav;
+static unsigned int captureSamplerate;
+static uint32_t captureBytes; // written to captureFile after any header
+static bool captureFailed; // by captureThread, if a write failed
+static bool captureFull; // by captureThread, if a WAV capture reached WAV_MAXDATABYTES
+
+// state snapshots for queries
+static SuperAudioSnapshot<VoiceState> voiceStates; // indexed by voice
+static VoiceState *voiceStatesCopy = nullptr; // Cocos thread: getStates() copies all of voiceStates here at once
+static uint64_t renderedSamples = 0; // audio thread only: the audio clock
+
+// the VoicePool arrays of one float per voice, for allocating and freeing them together
+static float *VoicePool::*voiceFloatArrays[] = {
+    &VoicePool::volumes, &VoicePool::pans, &VoicePool::sourceX, &VoicePool::sourceY, &VoicePool::minDistances, &VoicePool::maxDistances,
+    &VoicePool::rolloffs, &VoicePool::positional, &VoicePool::gainsLeft, &VoicePool::gainsRight, &VoicePool::lastGainsLeft, &VoicePool::lastGainsRight,
+    &VoicePool::dryLevels, &VoicePool::lastDryLevels
 };
-static PlayerInfo playerInfo[MAX_AUDIOINSTANCES];
 
 #if CC_TARGET_PLATFORM == CC_PLATFORM_IOS
 static SuperpoweredIOSAudioIO *audioSystem = nullptr;
@@ -75,9 +313,9 @@ static SuperpoweredIOSAudioIO *audioSystem = nullptr;
     - (void)interruptionStarted {} //The audio session may be interrupted by a phone call, etc. This method is called on the main thread when this happens.
     - (void)interruptionEnded {
         //The audio session may be interrupted by a phone call, etc. This method is called on the main thread when audio resumes.
-        for (auto info=playerInfo; info < &playerInfo[MAX_AUDIOINSTANCES]; info++) {
+        for (auto i=0; i < voices.capacity; i++) {
             // If a player plays Apple Lossless audio files, then we need this. Otherwise unnecessary.
-            if (info->player) info->player->onMediaserverInterrupt();
+            if (voices.players[i]) voices.players[i]->onMediaserverInterrupt();
         }
     }
     - (void)recordPermissionRefused {} //Called if the user did not grant a recording permission for the app.
@@ -97,101 +335,1083 @@ static std::string APKPath;
 // A few locally-scoped functions follow, which require Superpowered-specific data types
 //  (& therefore shouldn't go in SuperAudio.h and its class):
 
+static void *allocAligned(size_t bytes) { // zeroed and cache-line aligned, release with free()
+    void *p = nullptr;
+#if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
+    p = memalign(64, bytes);
+#else
+    if (posix_memalign(&p, 64, bytes) != 0) p = nullptr;
+#endif
+    if (p) memset(p, 0, bytes);
+    return p;
+}
+
 static PlayerInfo *getInfoForId(int id) {
-    return (id<0 || id>=MAX_AUDIOINSTANCES) ? nullptr : &playerInfo[id];
+    return (id<0 || id>=voices.capacity) ? nullptr : &voices.info[id];
+}
+
+static SuperpoweredAdvancedAudioPlayer *getPlayerForId(int id) {
+    return (id<0 || id>=voices.capacity) ? nullptr : voices.players[id];
+}
+
+// MARK: - state snapshots
+
+// called by the Cocos thread after changing a player's transport, so queries use the player's
+//   own fields until the audio thread publishes a state that includes the change
+static void transportChanged(int audioID) {
+    voices.transportSerials[audioID].fetch_add(1, std::memory_order_release);
+}
+
+// audio thread: publishes every voice's state after mixing a buffer
+static void publishStates(unsigned int numberOfSamples, unsigned int samplerate) {
+    renderedSamples += numberOfSamples;
+    auto audioTime = (double)renderedSamples / (double)samplerate;
+    auto states = voiceStates.back();
+    for (auto i=0; i < voices.capacity; i++) {
+        auto player = voices.players[i];
+        auto &state = states[i];
+        state.transportSerial = voices.seenSerials[i];
+        state.audioTime = audioTime;
+        state.open = player != nullptr;
+        state.playing = player && player->playing;
+        state.looping = player && player->looping;
+        state.positionMs = player ? player->displayPositionMs : 0;
+        state.durationMs = player ? (double)player->durationMs : 0;
+    }
+    voiceStates.publish();
+}
+
+// Cocos thread: the states of count voices starting at first, from published (a copy of the snapshot,
+//   or nullptr if there isn't one), using the player's own fields for voices whose transport changed since
+static void convertStates(const VoiceState *published, int first, int count, SuperAudio::AudioState *states) {
+    auto haveSnapshot = published != nullptr;
+    for (auto j=0; j < count; j++) {
+        auto i = first + j;
+        auto &state = states[j];
+        auto player = voices.players[i];
+        state.audioTime = haveSnapshot ? published[j].audioTime : 0;
+        if (player == nullptr) {
+            state.open = state.playing = state.looping = false;
+            state.currentTime = state.duration = -1;
+            continue;
+        }
+        double positionMs, durationMs;
+        state.open = true;
+        if (haveSnapshot && published[j].open &&
+            published[j].transportSerial == voices.transportSerials[i].load(std::memory_order_acquire)) {
+            state.playing = published[j].playing;
+            state.looping = published[j].looping;
+            positionMs = published[j].positionMs;
+            durationMs = published[j].durationMs;
+        } else { // changed since the audio thread last published
+            state.playing = player->playing;
+            state.looping = player->looping;
+            positionMs = player->displayPositionMs;
+            durationMs = (double)player->durationMs;
+        }
+        state.currentTime = (float)(positionMs / 1000.0);
+        state.duration = voices.info[i].nowLoading ? -1 : (float)(durationMs / 1000.0);
+    }
+}
+
+// Cocos thread: the states of up to 32 voices starting at first, from one copy of the snapshot
+static void readStates(int first, int count, SuperAudio::AudioState *states) {
+    VoiceState published[32];
+    convertStates(voiceStates.read(published, first, count) ? published : nullptr, first, count, states);
+}
+
+// MARK: - parameter ramps
+
+// called by the Cocos thread; the audio thread picks the ramp up at its next buffer
+static void requestRamp(int audioID, int parameter, float target, float seconds, SuperAudio::FadeCurve curve, SuperAudio::FinishCallback &&callback) {
+    auto info = getInfoForId(audioID);
+    if (info == nullptr) return;
+    auto &request = voices.rampRequests[audioID*RampCount + parameter];
+    auto &requestSerial = voices.rampRequestSerials[audioID*RampCount + parameter];
+    auto serial = requestSerial.load(std::memory_order_relaxed) + 2;
+    requestSerial.store(serial - 1, std::memory_order_relaxed); // odd: being written
+    std::atomic_thread_fence(std::memory_order_release);
+    request.target.store(target, std::memory_order_relaxed);
+    request.seconds.store(seconds, std::memory_order_relaxed);
+    request.curve.store((int)curve, std::memory_order_relaxed);
+    request.notify.store((bool)callback, std::memory_order_relaxed);
+    requestSerial.store(serial, std::memory_order_release);
+    info->targets[parameter] = target;
+    info->rampCallbacks[parameter] = std::move(callback);
+    info->rampSerials[parameter] = serial;
+}
+
+// sets a voice's parameters without ramping, while the audio thread isn't using it (no player)
+static void resetVoice(int audioID, float volume, VoicePool &pool = voices) {
+    auto info = &pool.info[audioID];
+    for (auto p=0; p < RampCount; p++) {
+        auto &ramp = pool.ramps[p][audioID];
+        ramp.value = ramp.start = ramp.target = (p == RampVolume) ? volume : rampDefaults[p];
+        ramp.elapsed = ramp.duration = 0;
+        ramp.curve = (int)SuperAudio::FadeCurve::Linear;
+        ramp.serial = pool.rampRequestSerials[audioID*RampCount + p].load(std::memory_order_relaxed);
+        ramp.notify = false;
+        ramp.active = false;
+        info->targets[p] = ramp.value;
+        info->rampCallbacks[p] = nullptr;
+    }
+    pool.positional[audioID] = 0;
+    pool.minDistances[audioID] = 1;
+    pool.maxDistances[audioID] = 1000;
+    pool.rolloffs[audioID] = 1;
+    pool.lastGainsLeft[audioID] = pool.lastGainsRight[audioID] = -1;
+    pool.dryLevels[audioID] = pool.lastDryLevels[audioID] = 1;
+    pool.meterPeaks[audioID] = 0;
+    pool.meterRms[audioID] = 0;
+    for (auto b=0; b < MAX_SENDBUSES; b++)
+        pool.sends[b*pool.capacity + audioID] = pool.lastSends[b*pool.capacity + audioID] = 0;
+}
+
+// frees a pool's arrays (its players must be deleted first)
+static void freeVoicePool(VoicePool &pool) {
+    free(pool.players);
+    for (auto p=0; p < RampCount; p++) free(pool.ramps[p]);
+    delete [] pool.rampRequestSerials;
+    delete [] pool.rampRequests;
+    delete [] pool.rampCompletedSerials;
+    for (auto array : voiceFloatArrays) free(pool.*array);
+    free(pool.sends);
+    free(pool.lastSends);
+    delete [] pool.meterPeaks;
+    delete [] pool.meterRms;
+    delete [] pool.transportSerials;
+    free(pool.seenSerials);
+    free(pool.startOffsets);
+    delete [] pool.info;
+    pool = VoicePool();
+}
+
+// allocates a pool's arrays, with every voice closed
+// returns false, with nothing allocated, if out of memory
+static bool allocVoicePool(VoicePool &pool, int capacity) {
+    pool = VoicePool();
+    pool.capacity = capacity;
+    auto ok = true;
+    auto check = [&ok](const void *array) { if (array == nullptr) ok = false; };
+    pool.players = (SuperpoweredAdvancedAudioPlayer **)allocAligned(capacity * sizeof(SuperpoweredAdvancedAudioPlayer *));
+    check(pool.players);
+    for (auto p=0; p < RampCount; p++) {
+        pool.ramps[p] = (Ramp *)allocAligned(capacity * sizeof(Ramp));
+        check(pool.ramps[p]);
+    }
+    pool.rampRequestSerials = new (std::nothrow) std::atomic<unsigned int>[capacity * RampCount]();
+    pool.rampRequests = new (std::nothrow) RampRequest[capacity * RampCount]();
+    pool.rampCompletedSerials = new (std::nothrow) std::atomic<unsigned int>[capacity * RampCount]();
+    check(pool.rampRequestSerials); check(pool.rampRequests); check(pool.rampCompletedSerials);
+    for (auto array : voiceFloatArrays) {
+        pool.*array = (float *)allocAligned(capacity * sizeof(float));
+        check(pool.*array);
+    }
+    pool.sends = (float *)allocAligned(capacity * MAX_SENDBUSES * sizeof(float));
+    pool.lastSends = (float *)allocAligned(capacity * MAX_SENDBUSES * sizeof(float));
+    pool.meterPeaks = new (std::nothrow) std::atomic<float>[capacity]();
+    pool.meterRms = new (std::nothrow) std::atomic<float>[capacity]();
+    pool.transportSerials = new (std::nothrow) std::atomic<unsigned int>[capacity]();
+    pool.seenSerials = (unsigned int *)allocAligned(capacity * sizeof(unsigned int));
+    pool.startOffsets = (unsigned int *)allocAligned(capacity * sizeof(unsigned int));
+    pool.info = new (std::nothrow) PlayerInfo[capacity];
+    check(pool.sends); check(pool.lastSends); check(pool.meterPeaks); check(pool.meterRms);
+    check(pool.transportSerials); check(pool.seenSerials); check(pool.startOffsets); check(pool.info);
+    if (!ok) {
+        freeVoicePool(pool);
+        return false;
+    }
+    for (auto i=0; i < capacity; i++) {
+        auto info = &pool.info[i];
+        pool.players[i] = nullptr;
+        info->nowLoading = false;
+        info->callbackWhenloaded = nullptr;
+        info->closeWhenDone = true;
+        info->callbackWhenDone = nullptr;
+        info->id = i;
+        info->limit = nullptr;
+        info->parked = false;
+        info->openOrder = 0;
+        info->pendingEvents = 0;
+        info->loadError[0] = 0;
+        resetVoice(i, 0.5f, pool);
+    }
+    return true;
+}
+
+static float rampValue(const Ramp &ramp) {
+    if (ramp.elapsed >= ramp.duration) return ramp.target;
+    auto t = (float)ramp.elapsed / (float)ramp.duration;
+    switch (ramp.curve) {
+        case (int)SuperAudio::FadeCurve::EqualPower: // stays between start and target
+            return ramp.start + (ramp.target - ramp.start) * sinf(t * 1.5707963f);
+        case RampCrossfade:
+            return ramp.start * cosf(t * 1.5707963f) + ramp.target * sinf(t * 1.5707963f);
+        case (int)SuperAudio::FadeCurve::Exponential:
+            if (ramp.start >= 0 && ramp.target >= 0) { // equal steps in dB, treating silence as -60 dB
+                auto from = fmaxf(ramp.start, 0.001f), to = fmaxf(ramp.target, 0.001f);
+                return from * powf(to / from, t);
+            }
+            break; // linear for negative values, such as pan
+        case (int)SuperAudio::FadeCurve::SCurve:
+            t = t * t * (3.0f - 2.0f * t);
+            break;
+        default:
+            break;
+    }
+    return ramp.start + (ramp.target - ramp.start) * t;
+}
+
+// audio thread: advances a voice parameter by one buffer, returning true if a ramp to notify about finished
+static bool advanceRamp(VoicePool &pool, int voice, int parameter, unsigned int numberOfSamples, unsigned int samplerate) {
+    auto &ramp = pool.ramps[parameter][voice];
+    auto &requestSerial = pool.rampRequestSerials[voice*RampCount + parameter];
+    auto serial = requestSerial.load(std::memory_order_acquire);
+    if ((serial & 1) == 0 && serial != ramp.serial) { // new request
+        auto &request = pool.rampRequests[voice*RampCount + parameter];
+        auto target = request.target.load(std::memory_order_relaxed);
+        auto seconds = request.seconds.load(std::memory_order_relaxed);
+        auto curve = request.curve.load(std::memory_order_relaxed);
+        auto notify = request.notify.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (requestSerial.load(std::memory_order_relaxed) == serial) { // else try again next buffer
+            ramp.start = ramp.value;
+            ramp.target = target;
+            ramp.elapsed = 0;
+            ramp.duration = (seconds > 0) ? (unsigned int)(seconds * samplerate) : 0;
+            ramp.curve = curve;
+            ramp.serial = serial;
+            ramp.notify = notify;
+            ramp.active = true;
+        }
+    }
+    if (!ramp.active) return false;
+
+    ramp.elapsed = (ramp.duration - ramp.elapsed > numberOfSamples) ? ramp.elapsed + numberOfSamples : ramp.duration;
+    ramp.value = rampValue(ramp);
+    if (ramp.elapsed < ramp.duration) return false;
+    ramp.active = false;
+    pool.rampCompletedSerials[voice*RampCount + parameter].store(ramp.serial, std::memory_order_release);
+    return ramp.notify;
+}
+
+// audio thread: computes every voice's left and right gains in one branch-free pass, from its
+//   volume, pan, and position relative to the listener.  The arrays are __restrict so that the
+//   compiler can vectorize this without alias checks (with clang's default -fno-trapping-math).
+static void computeGains(int count, float x, float y,
+                         const float *__restrict volumes, const float *__restrict pans, const float *__restrict positional,
+                         const float *__restrict sourceX, const float *__restrict sourceY,
+                         const float *__restrict minDistances, const float *__restrict maxDistances, const float *__restrict rolloffs,
+                         float *__restrict gainsLeft, float *__restrict gainsRight) {
+    for (auto i=0; i < count; i++) {
+        auto dx = sourceX[i] - x, dy = sourceY[i] - y;
+        auto distance = sqrtf(dx*dx + dy*dy);
+        auto minDistance = minDistances[i], maxDistance = maxDistances[i];
+        auto clamped = distance < minDistance ? minDistance : (distance > maxDistance ? maxDistance : distance);
+        auto attenuation = minDistance / (minDistance + rolloffs[i] * (clamped - minDistance)); // inverse distance
+        auto gain = volumes[i] * (1.0f + positional[i] * (attenuation - 1.0f));
+        auto pan = pans[i] + positional[i] * dx / (distance + minDistance); // direction, centered when close
+        pan = pan < -1.0f ? -1.0f : (pan > 1.0f ? 1.0f : pan);
+        gainsLeft[i] = gain * (pan > 0 ? 1.0f - pan : 1.0f); // balance: centered is unity gain on both sides
+        gainsRight[i] = gain * (pan < 0 ? 1.0f + pan : 1.0f);
+    }
+}
+
+// audio thread: adds (or copies) stereo input to output, with gains interpolated per sample
+static void mixStereo(const float *input, float *output, bool add, float left0, float right0, float left1, float right1, unsigned int numberOfSamples) {
+    auto leftStep = (left1 - left0) / (float)numberOfSamples, rightStep = (right1 - right0) / (float)numberOfSamples;
+    auto left = left0, right = right0;
+    if (add) {
+        for (unsigned int i=0; i < numberOfSamples; i++, input += 2, output += 2) {
+            output[0] += input[0] * left;
+            output[1] += input[1] * right;
+            left += leftStep;
+            right += rightStep;
+        }
+    } else {
+        for (unsigned int i=0; i < numberOfSamples; i++, input += 2, output += 2) {
+            output[0] = input[0] * left;
+            output[1] = input[1] * right;
+            left += leftStep;
+            right += rightStep;
+        }
+    }
+}
+
+// MARK: - metering
+
+// audio thread: peak and mean square of interleaved stereo
+static void measure(const float *input, unsigned int numberOfSamples, float &peak, float &meanSquare) {
+    float p = 0, sum = 0;
+    for (unsigned int i=0; i < numberOfSamples*2; i++) {
+        auto value = input[i];
+        auto magnitude = value < 0 ? -value : value;
+        p = magnitude > p ? magnitude : p;
+        sum += value * value;
+    }
+    peak = p;
+    meanSquare = sum / (float)(numberOfSamples*2);
+}
+
+// audio thread: peaks fall back with decay, RMS is smoothed by smoothing (both per buffer)
+static void updateMeter(std::atomic<float> &peakMeter, std::atomic<float> &rmsMeter, float peak, float meanSquare, float decay, float smoothing) {
+    auto held = peakMeter.load(std::memory_order_relaxed) * decay;
+    peakMeter.store(peak > held ? peak : held, std::memory_order_relaxed);
+    auto rms = rmsMeter.load(std::memory_order_relaxed);
+    rmsMeter.store(rms + (sqrtf(meanSquare) - rms) * smoothing, std::memory_order_relaxed);
+}
+
+// background thread: turns the tap of the master output into spectrumBands, until disabled
+static void analyzeSpectrum() {
+    const int size = 1 << SPECTRUM_LOGSIZE, bands = SuperAudio::SpectrumBands;
+    auto history = (float *)calloc(size, sizeof(float)); // latest samples, oldest first
+    auto real = (float *)allocAligned(size * sizeof(float));
+    auto imag = (float *)allocAligned(size * sizeof(float));
+    auto window = (float *)allocAligned(size * sizeof(float));
+    for (auto i=0; i < size; i++) window[i] = 0.5f - 0.5f * cosf(6.2831853f * i / size); // Hann
+
+    // log-spaced band edges over the positive frequencies' bins, at least one bin per band
+    int edges[SuperAudio::SpectrumBands + 1];
+    edges[0] = 1;
+    for (auto b=1; b <= bands; b++) {
+        auto edge = (int)(powf((float)(size/2), (float)b / bands) + 0.5f);
+        edges[b] = edge > edges[b-1] ? edge : edges[b-1] + 1;
+        if (edges[b] > size/2) edges[b] = size/2;
+    }
+
+    while (spectrumEnabled.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(15));
+        auto fresh = spectrumTap.available();
+        while (fresh > (unsigned int)size) { // fell behind: skip to the latest
+            auto skip = fresh - size;
+            fresh -= spectrumTap.read(real, skip < (unsigned int)size ? skip : size);
+        }
+        if (fresh == 0) continue;
+        memmove(history, history + fresh, (size - fresh) * sizeof(float));
+        spectrumTap.read(history + size - fresh, fresh);
+
+        for (auto i=0; i < size; i++) {
+            real[i] = history[i] * window[i];
+            imag[i] = 0;
+        }
+        SuperpoweredFFTComplex(real, imag, SPECTRUM_LOGSIZE, true);
+
+        // each band is the loudest bin in it
+        auto out = spectrumBands.back();
+        for (auto b=0; b < bands; b++) {
+            float loudest = 0;
+            for (auto k=edges[b]; k < edges[b+1]; k++) {
+                auto magnitude = sqrtf(real[k]*real[k] + imag[k]*imag[k]);
+                if (magnitude > loudest) loudest = magnitude;
+            }
+            out[b] = loudest * 4.0f / size; // 1.0 for a full-scale sine, after Hann window gain
+        }
+        spectrumBands.publish();
+    }
+
+    free(history);
+    free(real);
+    free(imag);
+    free(window);
+}
+
+// MARK: - music
+
+// audio thread: fades a voice's volume from the start of this buffer, overriding any ramp
+//   (a later request from the Cocos thread overrides this one)
+static void startFade(int audioID, float target, unsigned int samples) {
+    auto &ramp = voices.ramps[RampVolume][audioID];
+    ramp.start = ramp.value;
+    ramp.target = target;
+    ramp.elapsed = 0;
+    ramp.duration = samples;
+    ramp.curve = RampCrossfade;
+    ramp.notify = false;
+    ramp.active = true;
+}
+
+// audio thread: starts musicNext when the current track reaches its transition point, which is
+//   its end minus the crossfade, at that sample within this buffer.  The end comes from the
+//   player's whole-millisecond duration, so the splice may be up to a millisecond early
+//   (overlapping the current track's last samples, rather than leaving a gap).
+static void advanceMusic(unsigned int numberOfSamples, unsigned int samplerate) {
+    auto next = musicNext.load(std::memory_order_acquire);
+    if (next < 0 || voices.players[next] == nullptr) return;
+    auto crossfade = (unsigned int)(musicCrossfade.load(std::memory_order_relaxed) * samplerate);
+    auto immediate = musicImmediate.load(std::memory_order_relaxed);
+    auto current = musicCurrent.load(std::memory_order_relaxed);
+    auto currentPlayer = current >= 0 ? voices.players[current] : nullptr;
+    double startAt = 0; // samples into this buffer
+    if (currentPlayer && !immediate) {
+        auto remaining = ((double)currentPlayer->durationMs - currentPlayer->positionMs) * samplerate / 1000.0
+                         / voices.ramps[RampRate][current].value;
+        if (!currentPlayer->playing && remaining > numberOfSamples) return; // paused, not finished
+        startAt = remaining - crossfade;
+        if (startAt >= numberOfSamples) return; // not yet
+    }
+
+    if (!musicNext.compare_exchange_strong(next, -1, std::memory_order_acq_rel)) return; // taken back by cancelArmedMusic()
+    auto nextPlayer = voices.players[next];
+    voices.startOffsets[next] = startAt > 0 ? (unsigned int)startAt : 0;
+    voices.lastGainsLeft[next] = voices.lastGainsRight[next] = -1; // a splice, not a ramp from silence
+    voices.ramps[RampVolume][next].value = 0;
+    startFade(next, musicVolume.load(std::memory_order_relaxed), crossfade);
+    nextPlayer->play(false);
+    if (currentPlayer) {
+        if (crossfade) startFade(current, 0, crossfade);
+        else if (immediate) currentPlayer->pause();
+        // else it ends exactly where next starts
+    }
+    musicCurrent.store(next, std::memory_order_release);
+}
+
+// Cocos thread: the audio clock, as of the last published states
+static double audioClock() {
+    VoiceState state;
+    return voiceStates.read(&state, 0, 1) ? state.audioTime : 0;
+}
+
+// Cocos thread: whether audioID is still the instance opened as openOrder
+static bool isSameInstance(int audioID, unsigned int openOrder) {
+    return getPlayerForId(audioID) && voices.info[audioID].openOrder == openOrder;
+}
+
+// Cocos thread: takes back the armed track if the audio thread hasn't started it yet.  If it has,
+//   musicArmedID stays set until updateMusic() sees it published as musicCurrent.
+static void cancelArmedMusic() {
+    auto armed = musicArmedID;
+    if (armed < 0) return;
+    if (musicNext.compare_exchange_strong(armed, -1)) {
+        SuperAudio::stopAndClose(musicArmedID);
+        musicArmedID = -1;
+    }
+}
+
+// Cocos thread: fades out and closes a track which is no longer musicCurrent
+static void stopMusicTrack(int audioID, float fadeSeconds) {
+    if (fadeSeconds > 0)
+        SuperAudio::fadeTo(audioID, 0, fadeSeconds, SuperAudio::FadeCurve::Linear, [audioID]() { SuperAudio::stopAndClose(audioID); });
+    else
+        SuperAudio::stopAndClose(audioID);
+}
+
+// Cocos thread: drops the playlist and whatever is loading for it
+static void clearMusicPlaylist() {
+    musicPlaylist.clear();
+    musicNextTrack = 0;
+    musicFailures = 0;
+    if (musicPrefetchID >= 0 && isSameInstance(musicPrefetchID, musicPrefetchOrder))
+        SuperAudio::stopAndClose(musicPrefetchID);
+    musicPrefetchID = -1;
+    cancelArmedMusic();
+}
+
+// Cocos thread: counts a playlist track that couldn't be played, so a playlist that can't be
+//   (such as when every instance is in use) isn't retried every frame
+static void musicTrackFailed() {
+    if (++musicFailures == musicPlaylist.size())
+        CCLOG("SuperAudio music: no track of the playlist could be opened, so it has stopped");
+}
+
+// Cocos thread (once per frame): prefetches the next track, hands it to the audio thread once
+//   loaded, and closes tracks that were faded out mid-track
+static void updateMusic() {
+    auto current = musicCurrent.load(std::memory_order_acquire);
+    if (current != musicObservedID) { // the audio thread started the armed track
+        if (current == musicArmedID) {
+            if (musicObservedID >= 0 && musicArmedTrack.immediate) {
+                MusicOutgoing outgoing = { musicObservedID, voices.info[musicObservedID].openOrder, audioClock() + musicArmedTrack.crossfade };
+                musicOutgoing.push_back(outgoing);
+            }
+            musicArmedID = -1;
+            if (musicArmedStopFade >= 0) { // stopped while it was being started
+                if (musicCurrent.compare_exchange_strong(current, -1)) stopMusicTrack(current, musicArmedStopFade);
+                current = musicCurrent.load();
+                musicArmedStopFade = -1;
+            }
+        }
+        musicObservedID = current;
+    }
+    if (current >= 0 && getPlayerForId(current) == nullptr) { // closed by someone else
+        musicCurrent.compare_exchange_strong(current, -1);
+        musicObservedID = current = musicCurrent.load();
+    }
+    if (musicArmedID >= 0 && getPlayerForId(musicArmedID) == nullptr) { // closed by someone else
+        auto armed = musicArmedID;
+        musicNext.compare_exchange_strong(armed, -1);
+        musicArmedID = -1;
+        musicArmedStopFade = -1;
+    }
+
+    if (musicPrefetchID >= 0) {
+        if (!isSameInstance(musicPrefetchID, musicPrefetchOrder)) {
+            musicPrefetchID = -1; // failed to load, or closed by someone else: skip it
+            musicTrackFailed();
+        } else if (!voices.info[musicPrefetchID].nowLoading) {
+            voices.players[musicPrefetchID]->setPosition(0, true, false); // buffer the start
+            musicCrossfade.store(musicPrefetchTrack.crossfade, std::memory_order_relaxed);
+            musicImmediate.store(musicPrefetchTrack.immediate || current < 0, std::memory_order_relaxed);
+            musicArmedID = musicPrefetchID;
+            musicArmedTrack = musicPrefetchTrack;
+            musicArmedTrack.immediate = musicImmediate.load(std::memory_order_relaxed);
+            musicPrefetchID = -1;
+            musicFailures = 0;
+            musicNext.store(musicArmedID, std::memory_order_release);
+#if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
+            SuperpoweredCPU::setSustainedPerformanceMode(true);
+#endif
+        }
+    }
+
+    if (musicPrefetchID < 0 && musicArmedID < 0 && musicFailures < musicPlaylist.size()) {
+        if (musicNextTrack >= musicPlaylist.size() && musicRepeat) musicNextTrack = 0;
+        if (musicNextTrack < musicPlaylist.size()) {
+            musicPrefetchTrack = musicPlaylist[musicNextTrack];
+            musicPlaylist[musicNextTrack++].immediate = false; // repeats follow on at the end
+            musicPrefetchID = SuperAudio::open(musicPrefetchTrack.filePath, false, 0);
+            if (musicPrefetchID >= 0) {
+                musicPrefetchOrder = voices.info[musicPrefetchID].openOrder;
+            } else {
+                CCLOG("SuperAudio music %s couldn't be opened", musicPrefetchTrack.filePath.c_str());
+                musicTrackFailed();
+            }
+        }
+    }
+
+    for (auto i=musicOutgoing.size(); i-- > 0;) {
+        auto &outgoing = musicOutgoing[i];
+        if (!isSameInstance(outgoing.id, outgoing.openOrder)) {
+            musicOutgoing.erase(musicOutgoing.begin() + i);
+        } else if (audioClock() >= outgoing.closeAt) {
+            SuperAudio::stopAndClose(outgoing.id);
+            musicOutgoing.erase(musicOutgoing.begin() + i);
+        }
+    }
+}
+
+// MARK: - voices
+
+// finds the file to give a player for filePath, with fileLength 0 if it's the whole file
+static bool resolvePath(const std::string &filePath, std::string &fullPath, int &fileOffset, int &fileLength) {
+    fileOffset = fileLength = 0;
+#if CC_TARGET_PLATFORM == CC_PLATFORM_IOS || CC_TARGET_PLATFORM == CC_PLATFORM_MAC
+    fullPath = SuperAudioUtils::fullPathForFilename(filePath);
+    if (fullPath == "") return false; // no such filename
+#endif
+#if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
+    if (filePath[0] == '/') { // absolute, such as a file written by bounceToFile()
+        fullPath = filePath;
+        return true;
+    }
+    // Otherwise, path is ignored.  Instead, uses proj.android/app/src/main/res/raw, which uses APKPath
+    // Get 2 int values for file offset and length, using packed string returned from java
+    fullPath = APKPath;
+    int pos = filePath.rfind("/");
+    int start = (pos == std::string::npos) ? 0 : pos+1;
+    int len = filePath.rfind(".")-start;
+    std::string packedStr = cocos2d::JniHelper::callStaticStringMethod("org.cocos2dx.cpp/AppActivity", "getPackedString", filePath.substr(start, len));
+    if (packedStr == "") return false; // couldn't find match
+    std::string::size_type sz;
+    fileOffset = std::stoi(packedStr, &sz);
+    fileLength = std::stoi(packedStr.substr(sz+1));
+#endif
+    return true;
 }
 
 static void closePlayer(int audioID) {
     auto info = getInfoForId(audioID);
-    if (info && info->player) {
-        auto ip = info->player; // null before deleting so interrupt by outputProcessing is safe
-        info->player = nullptr;
-        delete ip; // info->player
+    if (info && voices.players[audioID]) {
+        auto ip = voices.players[audioID]; // null before deleting so interrupt by outputProcessing is safe
+        voices.players[audioID] = nullptr;
+        delete ip; // voices.players[audioID]
+        for (auto p=0; p < RampCount; p++) info->rampCallbacks[p] = nullptr; // not called if closed mid-ramp
+        info->limit = nullptr;
+        info->parked = false;
         if (info->callbackWhenloaded) {
-            auto cb = info->callbackWhenloaded;
+            auto cb = std::move(info->callbackWhenloaded);
             info->callbackWhenloaded = nullptr;
+            ALLOW_ALLOCATIONS;
             cb(-1, false); // signal error if premature close
         }
         if (info->callbackWhenDone) {
-            auto cb = info->callbackWhenDone;
+            auto cb = std::move(info->callbackWhenDone);
             info->callbackWhenDone = nullptr;
+            ALLOW_ALLOCATIONS;
             cb();
         }
     }
 }
 
+// closes a finished instance, or keeps it loaded if its sound has an instance limit
+static void finishPlayer(int audioID) {
+    auto info = getInfoForId(audioID);
+    if (info && voices.players[audioID]) {
+        if (info->limit && info->limit->maxInstances > 0)
+            info->parked = true;
+        else
+            closePlayer(audioID);
+    }
+}
+
+// how loud a voice is as heard, after volume, pan and distance (as of the last buffer)
+static float loudness(int audioID) {
+    return fmaxf(voices.gainsLeft[audioID], voices.gainsRight[audioID]);
+}
+
+// reuse an existing instance of a sound with an instance limit, rewinding it
+// returns nullptr if a new instance should be opened instead (or if ignore is set)
+static PlayerInfo *reuseInstance(const InstanceLimit *limit, bool &ignore) {
+    PlayerInfo *parked = nullptr, *oldest = nullptr, *quietest = nullptr;
+    int count = 0;
+    ignore = false;
+    for (auto info=voices.info; info < &voices.info[voices.capacity]; info++) {
+        if (voices.players[info->id] == nullptr || info->limit != limit) continue;
+        count++;
+        if (info->parked) {
+            if (!parked || info->openOrder < parked->openOrder) parked = info;
+        } else {
+            if (!oldest || info->openOrder < oldest->openOrder) oldest = info;
+            if (!quietest || loudness(info->id) < loudness(quietest->id)) quietest = info;
+        }
+    }
+
+    auto info = parked; // a finished instance is always the cheapest to reuse
+    if (info == nullptr) {
+        if (count < limit->maxInstances) return nullptr; // room for another instance
+        switch (limit->policy) {
+            case SuperAudio::InstancePolicy::RestartOldest: info = oldest; break;
+            case SuperAudio::InstancePolicy::StealQuietest: info = quietest; break;
+            case SuperAudio::InstancePolicy::IgnoreNew: ignore = true; return nullptr;
+        }
+        if (info == nullptr) return nullptr;
+    }
+
+    auto player = voices.players[info->id];
+    player->pause();
+    if (!info->nowLoading) player->setPosition(0, true, false);
+    transportChanged(info->id);
+    info->pendingEvents.fetch_and(~(unsigned int)PlayerEventEOF); // EOF of the previous trigger
+    info->parked = false;
+    if (info->callbackWhenDone) { // the previous trigger of this instance has ended
+        auto cb = std::move(info->callbackWhenDone);
+        info->callbackWhenDone = nullptr;
+        ALLOW_ALLOCATIONS;
+        cb();
+    }
+    return info;
+}
+
+// whether a player's EOF is about its current playback, rather than one since rewound
+static bool isAtEnd(SuperpoweredAdvancedAudioPlayer *player) {
+    return player->positionMs >= (double)player->durationMs - EOF_TOLERANCEMS;
+}
+
+// finds an empty slot, closing the oldest parked instance if there are none
+static PlayerInfo *getFreeInfo() {
+    PlayerInfo *parked = nullptr;
+    for (auto info=voices.info; info < &voices.info[voices.capacity]; info++) {
+        if (voices.players[info->id] == nullptr) return info;
+        if (info->parked && (!parked || info->openOrder < parked->openOrder)) parked = info;
+    }
+    if (parked) closePlayer(parked->id);
+    return parked;
+}
+
+// player events arrive on Superpowered's threads, and are recorded here without allocating
 static void playerEventCallback(void *clientdata, SuperpoweredAdvancedAudioPlayerEvent event, void *value) {
-    if (event == SuperpoweredAdvancedAudioPlayerEvent_EOF ||
-        event == SuperpoweredAdvancedAudioPlayerEvent_LoadError ||
-        event == SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess) {
-        auto info = (PlayerInfo *)clientdata;
-        
-        // make sure user is called back from main thread
-
-        SuperAudioUtils::useCocosThread([event,info,value]() { // lambda executes in main thread! :
-            auto id = info->id;
-            char *val1 = (char *)value;
-            std::string val2 = "";
-            if (val1) val2 = val1; // error code
-
-            switch (event) {
-                case SuperpoweredAdvancedAudioPlayerEvent_EOF:
-                    if (info->player && !info->player->looping) { // done playing
-                        info->player->pause();
+    auto info = (PlayerInfo *)clientdata;
+    switch (event) {
+        case SuperpoweredAdvancedAudioPlayerEvent_EOF:
+            info->pendingEvents.fetch_or(PlayerEventEOF);
+            break;
+        case SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess:
+            info->pendingEvents.fetch_or(PlayerEventLoadSuccess);
+            break;
+        case SuperpoweredAdvancedAudioPlayerEvent_LoadError:
+            strncpy(info->loadError, value ? (const char *)value : "", sizeof(info->loadError)-1); // error code
+            info->pendingEvents.fetch_or(PlayerEventLoadError);
+            break;
+        default:
+            break;
+    }
+}
+
+// make sure user is called back from main thread (called once per frame by the Cocos scheduler)
+static void dispatchPlayerEvents() {
+    for (auto info=voices.info; info < &voices.info[voices.capacity]; info++) {
+        if (info->pendingEvents.load(std::memory_order_relaxed) == 0) continue;
+        auto events = info->pendingEvents.exchange(0);
+        auto id = info->id;
+
+        if (events & PlayerEventLoadSuccess) {
+            CCLOG("SuperAudio file id: %d now loaded", id);
+            info->nowLoading = false;
+            if (info->callbackWhenloaded) {
+                auto cb = std::move(info->callbackWhenloaded);
+                info->callbackWhenloaded = nullptr;
+                cb(id, true);
+            }
+        }
+        if (events & PlayerEventLoadError) {
+            CCLOG("SuperAudio LoadError: %s", info->loadError);
+            // NOTE: if you get this error on an MP3 with "Unknown file format" for value,
+            // it's because this file is NOT encoded at MPEG Level 3, as required by the
+            // Superpowered library for Android.
+            info->nowLoading = false;
+            closePlayer(id);
+        }
+        for (auto p=0; p < RampCount; p++) {
+            if ((events & (PlayerEventRampDone << p)) && info->rampCallbacks[p] &&
+                voices.rampCompletedSerials[id*RampCount + p].load(std::memory_order_acquire) == info->rampSerials[p]) {
+                auto cb = std::move(info->rampCallbacks[p]);
+                info->rampCallbacks[p] = nullptr;
+                cb();
+            }
+        }
+        if (events & PlayerEventEOF) {
+            auto player = voices.players[id];
+            // an EOF from before the instance was rewound by reuseInstance() may arrive after it
+            if (player && !player->looping && isAtEnd(player)) { // done playing
+                player->pause();
+                transportChanged(id);
 #if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
-                        SuperpoweredCPU::setSustainedPerformanceMode(false);
+                SuperpoweredCPU::setSustainedPerformanceMode(false);
 #endif
-                        if (info->callbackWhenDone) {
-                            auto cb = info->callbackWhenDone;
-                            info->callbackWhenDone = nullptr;
-                            if (info->closeWhenDone) closePlayer(id);
-                            cb();
-                        } else {
-                            if (info->closeWhenDone) closePlayer(id);
-                        }
-                    }
-                    break;
-                case SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess:
-                    CCLOG("SuperAudio file id: %d now loaded", id);
-                    info->nowLoading = false;
-                    if (info->callbackWhenloaded) {
-                        auto cb = info->callbackWhenloaded;
-                        info->callbackWhenloaded = nullptr;
-                        cb(id, true);
-                    }
-                    break;
-                case SuperpoweredAdvancedAudioPlayerEvent_LoadError:
-                    CCLOG("SuperAudio LoadError: %s", val1);
-                    // NOTE: if you get this error on an MP3 with "Unknown file format" for value,
-                    // it's because this file is NOT encoded at MPEG Level 3, as required by the
-                    // Superpowered library for Android.
-                    info->nowLoading = false;
-                    closePlayer(id);
-                    break;
-                default:
-                    break;
+                if (info->callbackWhenDone) {
+                    auto cb = std::move(info->callbackWhenDone);
+                    info->callbackWhenDone = nullptr;
+                    if (info->closeWhenDone) finishPlayer(id);
+                    cb();
+                } else {
+                    if (info->closeWhenDone) finishPlayer(id);
+                }
+            }
+        }
+    }
+    updateMusic();
+}
+
+// renders a voice into buffer, after startOffset samples of silence
+static bool processVoice(SuperpoweredAdvancedAudioPlayer *player, float *buffer, unsigned int startOffset, unsigned int numberOfSamples) {
+    if (startOffset == 0) return player->process(buffer, false, numberOfSamples);
+    if (!player->process(buffer + startOffset*2, false, numberOfSamples - startOffset)) return false;
+    memset(buffer, 0, startOffset * 2 * sizeof(float));
+    return true;
+}
+
+// Advances the ramps and mixes every voice of a pool into output (overwriting it, if returning
+//   true), using scratch for one voice at a time.  Used by outputProcessing() for the device, and
+//   by offline bounces (with no sends or metering) so that they sound the same.
+static bool mixVoices(VoicePool &pool, float *output, float *scratch, unsigned int numberOfSamples, unsigned int samplerate,
+                      int busCount, bool *busHasData, bool metering) {
+    auto players = pool.players;
+    auto count = pool.capacity;
+    for (auto i=0; i < count; i++) { // advance parameter ramps
+        auto player = players[i];
+        if (player == nullptr) continue;
+        auto rate = pool.ramps[RampRate][i].value;
+        for (auto p=0; p < RampCount; p++) {
+            if (advanceRamp(pool, i, p, numberOfSamples, samplerate))
+                pool.info[i].pendingEvents.fetch_or(PlayerEventRampDone << p);
+        }
+        if (pool.ramps[RampRate][i].value != rate) // rate can only change once per buffer
+            player->setTempo(pool.ramps[RampRate][i].value, false);
+        pool.volumes[i] = pool.ramps[RampVolume][i].value;
+        pool.pans[i] = pool.ramps[RampPan][i].value;
+    }
+    computeGains(count, listenerX, listenerY, pool.volumes, pool.pans, pool.positional, pool.sourceX, pool.sourceY,
+                 pool.minDistances, pool.maxDistances, pool.rolloffs, pool.gainsLeft, pool.gainsRight);
+
+    auto haveData = false;
+    auto gainsLeft = pool.gainsLeft, gainsRight = pool.gainsRight;
+    auto lastGainsLeft = pool.lastGainsLeft, lastGainsRight = pool.lastGainsRight;
+    auto sends = pool.sends, lastSends = pool.lastSends;
+    auto meterDecay = expf(-(float)numberOfSamples / (0.3f * samplerate)); // peaks fall 8.7 dB per 0.3 sec
+    auto meterSmoothing = 1.0f - expf(-(float)numberOfSamples / (0.1f * samplerate)); // RMS over about 0.1 sec
+    for (auto i=0; i < count; i++) { // merge all playing sounds
+        auto player = players[i];
+        if (player == nullptr) continue;
+
+        auto left1 = gainsLeft[i], right1 = gainsRight[i];
+        auto left0 = lastGainsLeft[i] < 0 ? left1 : lastGainsLeft[i];
+        auto right0 = lastGainsRight[i] < 0 ? right1 : lastGainsRight[i];
+        lastGainsLeft[i] = left1;
+        lastGainsRight[i] = right1;
+        auto dry0 = pool.lastDryLevels[i], dry1 = pool.dryLevels[i];
+        pool.lastDryLevels[i] = dry1;
+        auto sending = false;
+        for (auto b=0; b < busCount; b++) {
+            if (sends[b*count + i] != 0 || lastSends[b*count + i] != 0) sending = true;
+        }
+
+        auto startOffset = pool.startOffsets[i];
+        pool.startOffsets[i] = 0;
+        if (!metering && !sending && !startOffset && dry0 == 1 && dry1 == 1 && left0 == right0 && left1 == right1 && left0 == left1) {
+            // centered and steady with no sends or metering: player applies volume
+            if (player->process(output, haveData, numberOfSamples, left1))
+                haveData = true;
+        } else if (!processVoice(player, scratch, startOffset, numberOfSamples)) {
+            if (metering) updateMeter(pool.meterPeaks[i], pool.meterRms[i], 0, 0, meterDecay, meterSmoothing);
+        } else {
+            if (metering) { // after volume, pan and position (using the louder side)
+                float peak, meanSquare, gain = left1 > right1 ? left1 : right1;
+                measure(scratch, numberOfSamples, peak, meanSquare);
+                updateMeter(pool.meterPeaks[i], pool.meterRms[i], peak * gain, meanSquare * gain * gain, meterDecay, meterSmoothing);
+            }
+            mixStereo(scratch, output, haveData, left0*dry0, right0*dry0, left1*dry1, right1*dry1, numberOfSamples);
+            haveData = true;
+            for (auto b=0; b < busCount; b++) { // send levels follow the voice's volume, pan and position
+                auto send0 = lastSends[b*count + i], send1 = sends[b*count + i];
+                lastSends[b*count + i] = send1;
+                if (send0 == 0 && send1 == 0) continue;
+                mixStereo(scratch, sendBuses[b].buffer, busHasData[b], left0*send0, right0*send0, left1*send1, right1*send1, numberOfSamples);
+                busHasData[b] = true;
             }
-        });
+        }
+    }
+    return haveData;
+}
+
+// MARK: - offline bounce
+
+// a sound of a bounce, with its file found on the calling thread
+struct BounceSource {
+    const SuperAudio::BounceSound *sound;
+    std::string fullPath;
+    int fileOffset, fileLength;
+};
+
+// waits until no playing player of a bounce is waiting for its decoder, returning false if timed out
+static bool waitForBuffering(const VoicePool &pool, int count) {
+    for (auto waited=0; waited < BOUNCE_LOADTIMEOUT; waited++) {
+        auto buffering = false;
+        for (auto i=0; i < count && !buffering; i++) {
+            buffering = pool.players[i]->playing && pool.players[i]->waitingForBuffering;
+        }
+        if (!buffering) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+    return false;
+}
+
+// Renders sources into output (interleaved stereo) with a voice pool of its own, as fast as
+//   its players decode.  If frames is 0, renders until the last source ends.  Called on any thread.
+static bool renderBounce(const BounceSource *sources, int count, unsigned int frames, unsigned int samplerate, std::vector<float> &output) {
+    VoicePool pool;
+    if (!allocVoicePool(pool, count)) {
+        CCLOG("SuperAudio bounce: out of memory");
+        return false;
+    }
+    for (auto i=0; i < count; i++) {
+        auto player = new SuperpoweredAdvancedAudioPlayer(&pool.info[i], playerEventCallback, samplerate, 0);
+        if (sources[i].fileLength)
+            player->open(sources[i].fullPath.c_str(), sources[i].fileOffset, sources[i].fileLength);
+        else
+            player->open(sources[i].fullPath.c_str());
+        pool.players[i] = player;
+    }
+
+    // player events arrive on Superpowered's threads, so wait for them here
+    auto loaded = false;
+    auto waited = 0;
+    for (; waited < BOUNCE_LOADTIMEOUT; waited++) {
+        auto loading = 0, failed = -1;
+        for (auto i=0; i < count; i++) {
+            auto events = pool.info[i].pendingEvents.load(std::memory_order_acquire);
+            if (events & PlayerEventLoadError) failed = i;
+            else if (!(events & PlayerEventLoadSuccess)) loading++;
+        }
+        if (failed >= 0) {
+            CCLOG("SuperAudio bounce: %s couldn't be loaded", sources[failed].sound->filePath.c_str());
+            break;
+        }
+        if (loading == 0) {
+            loaded = true;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (waited == BOUNCE_LOADTIMEOUT)
+        CCLOG("SuperAudio bounce: timed out loading files");
+
+    if (loaded) {
+        std::vector<unsigned int> startFrames(count);
+        unsigned int endFrame = 0;
+        for (auto i=0; i < count; i++) {
+            auto sound = sources[i].sound;
+            auto rate = fminf(4, fmaxf(0.25f, sound->rate));
+            resetVoice(i, fminf(1, fmaxf(0, sound->volume)), pool);
+            pool.ramps[RampPan][i].value = fminf(1, fmaxf(-1, sound->pan));
+            pool.ramps[RampRate][i].value = rate;
+            if (rate != 1) pool.players[i]->setTempo(rate, false);
+            pool.info[i].pendingEvents = 0;
+            startFrames[i] = (unsigned int)(fmaxf(0, sound->startTime) * samplerate);
+            auto end = startFrames[i] + (unsigned int)((double)pool.players[i]->durationMs * samplerate / 1000.0 / rate);
+            if (end > endFrame) endFrame = end;
+        }
+        if (frames == 0) frames = endFrame;
+        output.assign(frames * 2, 0.0f);
+
+        auto block = (float *)allocAligned(BOUNCE_BUFFERBYTES); // padded, so it isn't output directly
+        auto scratch = (float *)allocAligned(BOUNCE_BUFFERBYTES);
+        std::vector<bool> started(count, false);
+        for (unsigned int done=0; done < frames; done += BOUNCE_BLOCKSIZE) {
+            auto numberOfSamples = frames - done < BOUNCE_BLOCKSIZE ? frames - done : BOUNCE_BLOCKSIZE;
+            for (auto i=0; i < count; i++) { // start each sound at its exact sample
+                if (started[i] || startFrames[i] >= done + numberOfSamples) continue;
+                pool.startOffsets[i] = startFrames[i] > done ? startFrames[i] - done : 0;
+                pool.players[i]->play(false);
+                started[i] = true;
+            }
+            // players decode on their own threads and output silence when behind, so let them catch up
+            if (!waitForBuffering(pool, count)) {
+                CCLOG("SuperAudio bounce: timed out waiting for files to decode");
+                loaded = false;
+                break;
+            }
+            if (mixVoices(pool, block, scratch, numberOfSamples, samplerate, 0, nullptr, false))
+                memcpy(&output[done * 2], block, numberOfSamples * 2 * sizeof(float));
+            for (auto i=0; i < count; i++) {
+                if (pool.info[i].pendingEvents.exchange(0) & PlayerEventEOF) pool.players[i]->pause();
+            }
+        }
+        free(block);
+        free(scratch);
+    }
+
+    for (auto i=0; i < count; i++) delete pool.players[i];
+    freeVoicePool(pool);
+    return loaded;
+}
+
+// writes the header of a stereo WAV file, 16-bit or float, followed by dataBytes of samples
+// float files get the extended fmt chunk and the fact chunk that non-PCM formats require (58 bytes, rather than 44)
+static bool writeWavHeader(FILE *file, unsigned int samplerate, bool isFloat, uint32_t dataBytes) {
+    unsigned char header[58], *p = header;
+    auto put = [&p](uint32_t value, int bytes) {
+        for (auto i=0; i < bytes; i++) *p++ = (unsigned char)(value >> (8*i)); // little-endian
+    };
+    auto bytesPerFrame = isFloat ? 8 : 4;
+    auto headerBytes = isFloat ? 58 : 44;
+    memcpy(p, "RIFF", 4); p += 4;
+    put(headerBytes - 8 + dataBytes, 4);
+    memcpy(p, "WAVEfmt ", 8); p += 8;
+    put(isFloat ? 18 : 16, 4); // fmt chunk size
+    put(isFloat ? 3 : 1, 2); // IEEE float or PCM
+    put(2, 2); // channels
+    put(samplerate, 4);
+    put(samplerate * bytesPerFrame, 4);
+    put(bytesPerFrame, 2);
+    put(bytesPerFrame * 4, 2); // bits per sample
+    if (isFloat) {
+        put(0, 2); // no extension
+        memcpy(p, "fact", 4); p += 4;
+        put(4, 4);
+        put(dataBytes / bytesPerFrame, 4); // sample frames
+    }
+    memcpy(p, "data", 4); p += 4;
+    put(dataBytes, 4);
+    return fwrite(header, headerBytes, 1, file) == 1;
+}
+
+// MARK: - capture
+
+// background thread: writes captureRing to captureFile in batches, until stopped and drained
+static void writeCapture() {
+    auto samples = (float *)malloc(CAPTURE_BATCH * sizeof(float));
+    while (true) {
+        auto running = capturing.load(std::memory_order_acquire);
+        auto available = captureRing.available() & ~1u; // whole stereo samples
+        if (running && available < CAPTURE_BATCH) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+        if (available == 0) break; // stopped, and all written
+        auto count = captureRing.read(samples, available < CAPTURE_BATCH ? available : CAPTURE_BATCH);
+        if (captureFull) continue; // drained, and dropped
+        if (captureIsWav && count > (WAV_MAXDATABYTES - captureBytes) / sizeof(float)) { // the rest can't be described
+            count = (unsigned int)((WAV_MAXDATABYTES - captureBytes) / sizeof(float)) & ~1u;
+            captureFull = true;
+            capturing.store(false, std::memory_order_release); // stops the audio thread writing captureRing
+        }
+        if (!captureFailed && fwrite(samples, sizeof(float), count, captureFile) != count) captureFailed = true;
+        captureBytes += count * sizeof(float);
+    }
+    free(samples);
 }
 
 // MARK: - private class methods:
 
 /*static*/ bool SuperAudio::outputProcessing(void *clientdata, float **buffers, short int *buffer, unsigned int numberOfSamples, unsigned int samplerate) {
+    TRAP_ALLOCATIONS;
 
 #if CC_TARGET_PLATFORM == CC_PLATFORM_IOS
     if (samplerate != lastSamplerate) {
         lastSamplerate = samplerate;
-        for (auto info=playerInfo; info < &playerInfo[MAX_AUDIOINSTANCES]; info++) {
-            if (info->player) info->player->setSamplerate(samplerate);
+        for (auto i=0; i < voices.capacity; i++) {
+            if (voices.players[i]) voices.players[i]->setSamplerate(samplerate);
+        }
+        for (auto b=0; b < sendBusCount.load(std::memory_order_acquire); b++) {
+            if (sendBuses[b].reverb) sendBuses[b].reverb->setSamplerate(samplerate);
+            if (sendBuses[b].filter) sendBuses[b].filter->setSamplerate(samplerate);
         }
+        masterCompressor->setSamplerate(samplerate);
+        masterLimiter->setSamplerate(samplerate);
     }
 #endif
     
-    auto haveData = false;
-    for (auto info=playerInfo; info < &playerInfo[MAX_AUDIOINSTANCES]; info++) { // merge all playing sounds
-         if (info->player && info->player->process(outputBuffer, haveData, numberOfSamples, info->volume))
+    for (auto i=0; i < voices.capacity; i++) // transport changes that this buffer's states will include
+        voices.seenSerials[i] = voices.transportSerials[i].load(std::memory_order_acquire);
+    advanceMusic(numberOfSamples, samplerate);
+    auto busCount = sendBusCount.load(std::memory_order_acquire);
+    bool busHasData[MAX_SENDBUSES] = { false };
+    auto metering = meteringEnabled.load(std::memory_order_relaxed);
+    auto haveData = mixVoices(voices, outputBuffer, voiceBuffer, numberOfSamples, samplerate, busCount, busHasData, metering);
+
+    publishStates(numberOfSamples, samplerate);
+
+    // each bus's effect runs once per buffer, however many voices send to it
+    for (auto b=0; b < busCount; b++) {
+        auto &bus = sendBuses[b];
+        if (!busHasData[b]) {
+            if (bus.reverb == nullptr) continue; // only a reverb has a tail to keep processing
+            memset(bus.buffer, 0, numberOfSamples * 2 * sizeof(float));
+        }
+        auto processed = bus.reverb ? bus.reverb->process(bus.buffer, bus.buffer, numberOfSamples)
+                                    : bus.filter->process(bus.buffer, bus.buffer, numberOfSamples);
+        if (!processed) continue;
+        if (!haveData) {
+            memset(outputBuffer, 0, numberOfSamples * 2 * sizeof(float));
             haveData = true;
+        }
+        SuperpoweredVolumeAdd(bus.buffer, outputBuffer, bus.returnLevel, bus.returnLevel, numberOfSamples);
+    }
+
+    if (haveData) { // these do nothing unless enabled
+        masterCompressor->process(outputBuffer, outputBuffer, numberOfSamples);
+        masterLimiter->process(outputBuffer, outputBuffer, numberOfSamples);
+    }
+
+    if (metering) {
+        float peak = 0, meanSquare = 0;
+        if (haveData) measure(outputBuffer, numberOfSamples, peak, meanSquare);
+        updateMeter(masterPeak, masterRms, peak, meanSquare, expf(-(float)numberOfSamples / (0.3f * samplerate)),
+                    1.0f - expf(-(float)numberOfSamples / (0.1f * samplerate)));
+    }
+    if (spectrumEnabled.load(std::memory_order_relaxed)) { // mono tap, dropped if the analysis falls behind
+        for (unsigned int i=0; i < numberOfSamples; i++)
+            voiceBuffer[i] = haveData ? 0.5f * (outputBuffer[i*2] + outputBuffer[i*2 + 1]) : 0;
+        spectrumTap.write(voiceBuffer, numberOfSamples);
+    }
+    if (capturing.load(std::memory_order_relaxed)) { // whole buffers only, counted if there's no room
+        if (captureRing.space() < numberOfSamples * 2) {
+            captureOverflows.fetch_add(numberOfSamples, std::memory_order_relaxed);
+        } else if (haveData) {
+            captureRing.write(outputBuffer, numberOfSamples * 2);
+        } else { // silence
+            memset(voiceBuffer, 0, numberOfSamples * 2 * sizeof(float));
+            captureRing.write(voiceBuffer, numberOfSamples * 2);
+        }
     }
 
     if (haveData) {
@@ -206,47 +1426,67 @@ static void playerEventCallback(void *clientdata, SuperpoweredAdvancedAudioPlaye
 
 /*static*/ bool SuperAudio::lazyInit() {
     if (outputBuffer != nullptr) return true; // init static vars only once
-    
-    for (auto i=0; i < MAX_AUDIOINSTANCES; i++) {
-        auto info = getInfoForId(i);
-        info->player = nullptr;
-        info->nowLoading = false;
-        info->callbackWhenloaded = nullptr;
-        info->volume = 0.5f;
-        info->closeWhenDone = true;
-        info->callbackWhenDone = nullptr;
-        info->id = i;
+    return init(DEFAULT_AUDIOINSTANCES);
+}
+
+// MARK: - public class methods:
+
+/*static*/ bool SuperAudio::init(int maxAudioInstances) {
+    if (outputBuffer != nullptr) return maxAudioInstances == voices.capacity; // call end() first to resize
+    if (maxAudioInstances < 1) return false;
+
+    if (!allocVoicePool(voices, maxAudioInstances)) return false;
+    voiceStatesCopy = (VoiceState *)calloc(maxAudioInstances, sizeof(VoiceState));
+    if (!voiceStates.allocate(maxAudioInstances) || voiceStatesCopy == nullptr) {
+        voiceStates.release();
+        free(voiceStatesCopy);
+        voiceStatesCopy = nullptr;
+        freeVoicePool(voices);
+        return false;
     }
+    renderedSamples = 0;
+    SuperAudioUtils::scheduleEveryFrame(&voices, dispatchPlayerEvents);
+
+#if CC_TARGET_PLATFORM == CC_PLATFORM_IOS || CC_TARGET_PLATFORM == CC_PLATFORM_MAC
+    outputBufferBytes = 4096+128;
+#endif
+#if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
+    // call Java to get output samplerate, buffersize and APKPath
+    lastSamplerate = cocos2d::JniHelper::callStaticIntMethod("org.cocos2dx.cpp/AppActivity", "getSampleRate");
+    auto buffersize = cocos2d::JniHelper::callStaticIntMethod("org.cocos2dx.cpp/AppActivity", "getBuffersize");
+    APKPath = cocos2d::JniHelper::callStaticStringMethod("org.cocos2dx.cpp/AppActivity", "getAPKPath");
+    outputBufferBytes = (buffersize+16)*sizeof(float)*2;
+#endif
+    outputBuffer = (float *)allocAligned(outputBufferBytes);
+    voiceBuffer = (float *)allocAligned(outputBufferBytes);
+    masterCompressor = new SuperpoweredCompressor(lastSamplerate);
+    masterLimiter = new SuperpoweredLimiter(lastSamplerate);
 
 #if CC_TARGET_PLATFORM == CC_PLATFORM_IOS
-    posix_memalign((void **)&outputBuffer, 16, 4096+128);
     outDelegate = [[OutDelegate alloc] init];
     audioSystem = [[SuperpoweredIOSAudioIO alloc] initWithDelegate: (id<SuperpoweredIOSAudioIODelegate>)outDelegate preferredBufferSize:12 preferredSamplerate:lastSamplerate audioSessionCategory:AVAudioSessionCategoryPlayback channels:2 audioProcessingCallback:SuperAudio::audioProcessing clientdata:nil];
     [audioSystem start];
 #endif
 #if CC_TARGET_PLATFORM == CC_PLATFORM_MAC
-    posix_memalign((void **)&outputBuffer, 16, 4096+128);
     audioSystem = [[SuperpoweredOSXAudioIO alloc] initWithDelegate:nil preferredBufferSizeMs:12 numberOfChannels:2 enableInput:false enableOutput:true];
     [audioSystem setProcessingCallback_C:SuperAudio::audioProcessing clientdata:nullptr];
     [audioSystem start];
 #endif
 #if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
-    // call Java to get output samplerate, buffersize and APKPath
-    lastSamplerate = cocos2d::JniHelper::callStaticIntMethod("org.cocos2dx.cpp/AppActivity", "getSampleRate");
-    auto buffersize = cocos2d::JniHelper::callStaticIntMethod("org.cocos2dx.cpp/AppActivity", "getBuffersize");
-    APKPath = cocos2d::JniHelper::callStaticStringMethod("org.cocos2dx.cpp/AppActivity", "getAPKPath");
-    outputBuffer = (float *)memalign(16, (buffersize+16)*sizeof(float)*2);
     audioSystem = new SuperpoweredAndroidAudioIO(lastSamplerate, buffersize, false, true, SuperAudio::audioProcessing, nullptr, -1, SL_ANDROID_STREAM_MEDIA); //, buffersize*2);
 #endif
     return true;
 }
 
-// MARK: - public class methods:
-
 /*static*/ void SuperAudio::end() {
     if (outputBuffer == nullptr) return; // already ended
 
+    stopMusic();
     stopAndCloseAll();
+    musicOutgoing.clear();
+    SuperAudioUtils::unscheduleEveryFrame(&voices);
+    setSpectrumEnabled(false);
+    stopCapture();
 
 #if CC_TARGET_PLATFORM == CC_PLATFORM_IOS
     [audioSystem stop];
@@ -270,48 +1510,101 @@ static void playerEventCallback(void *clientdata, SuperpoweredAdvancedAudioPlaye
     
     free(outputBuffer);
     outputBuffer = nullptr;
+    free(voiceBuffer);
+    voiceBuffer = nullptr;
+    freeVoicePool(voices);
+    voiceStates.release();
+    free(voiceStatesCopy);
+    voiceStatesCopy = nullptr;
+    for (auto b=0; b < sendBusCount; b++) {
+        delete sendBuses[b].reverb;
+        delete sendBuses[b].filter;
+        free(sendBuses[b].buffer);
+        sendBuses[b] = SendBus();
+    }
+    sendBusCount = 0;
+    delete masterCompressor;
+    masterCompressor = nullptr;
+    delete masterLimiter;
+    masterLimiter = nullptr;
 }
 
-/*static*/ int SuperAudio::open(const std::string &filePath, bool loop, float volume, bool closeAtFinish, const std::function<void(int id, bool isSuccess)> &callback) {
+/*static*/ void SuperAudio::setInstanceLimit(const std::string &filePath, int maxInstances, InstancePolicy policy) {
+    // entries are never erased, since open instances point to them
+    auto &limit = instanceLimits[filePath];
+    limit.maxInstances = maxInstances < 0 ? 0 : maxInstances;
+    limit.policy = policy;
+}
+
+/*static*/ int SuperAudio::open(const std::string &filePath, bool loop, float volume, bool closeAtFinish, OpenCallback callback) {
     int id = -1; // default error return
     
     if (filePath != "" && lazyInit()) {
-        
+        const InstanceLimit *limit = nullptr;
+        auto found = instanceLimits.find(filePath);
+        if (found != instanceLimits.end() && found->second.maxInstances > 0) limit = &found->second;
+
+      if (limit) { // retrigger an existing instance rather than loading the file again
+        TRAP_ALLOCATIONS; // the steady state of a sound with an instance limit
+        bool ignore;
+        auto info = reuseInstance(limit, ignore);
+        if (ignore) {
+            if (callback) {
+                ALLOW_ALLOCATIONS;
+                callback(-1, false);
+            }
+            return -1;
+        }
+        if (info) {
+            if (info->callbackWhenloaded) { // previous opener never saw it load
+                auto cb = std::move(info->callbackWhenloaded);
+                info->callbackWhenloaded = nullptr;
+                ALLOW_ALLOCATIONS;
+                cb(-1, false);
+            }
+            info->closeWhenDone = closeAtFinish;
+            info->openOrder = ++openCount;
+            id = info->id;
+            setVolume(id, volume);
+            setPan(id, 0);
+            setRate(id, 1);
+            setNonPositional(id);
+            setDryLevel(id, 1);
+            for (auto b=0; b < MAX_SENDBUSES; b++) setSend(id, b, 0);
+            setLoop(id, loop);
+            if (info->nowLoading) {
+                info->callbackWhenloaded = std::move(callback);
+            } else if (callback) {
+                ALLOW_ALLOCATIONS;
+                callback(id, true);
+            }
+            return id;
+        }
+      }
+
       // look for empty slot to play from
-      for (auto info=playerInfo; info < &playerInfo[MAX_AUDIOINSTANCES]; info++) {
-        if (info->player == nullptr) { // found empty slot
-            int fileOffset = 0, fileLength = 0;
+      auto info = getFreeInfo();
+      if (info) {
+        do {
+            int fileOffset, fileLength;
             std::string fullPath;
-#if CC_TARGET_PLATFORM == CC_PLATFORM_IOS || CC_TARGET_PLATFORM == CC_PLATFORM_MAC
-            fullPath = SuperAudioUtils::fullPathForFilename(filePath);
-            if (fullPath == "") break; // no such filename, id=-1 still
-#endif
-#if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
-            // Path is ignored.  Instead, uses proj.android/app/src/main/res/raw, which uses APKPath
-            // Get 2 int values for file offset and length, using packed string returned from java
-            fullPath = APKPath;
-            int pos = filePath.rfind("/");
-            int start = (pos == std::string::npos) ? 0 : pos+1;
-            int len = filePath.rfind(".")-start;
-            std::string packedStr = cocos2d::JniHelper::callStaticStringMethod("org.cocos2dx.cpp/AppActivity", "getPackedString", filePath.substr(start, len));
-            if (packedStr == "") break; // couldn't find match, id=-1 still
-            std::string::size_type sz;
-            fileOffset = std::stoi(packedStr, &sz);
-            fileLength = std::stoi(packedStr.substr(sz+1));
-#endif
+            if (!resolvePath(filePath, fullPath, fileOffset, fileLength)) break; // no such file, id=-1 still
             info->nowLoading = true;
-            info->callbackWhenloaded = callback;
-            info->player = new SuperpoweredAdvancedAudioPlayer(info, playerEventCallback, lastSamplerate, 0);
+            info->callbackWhenloaded = std::move(callback);
+            info->pendingEvents = 0;
+            resetVoice(info->id, fminf(1, fmaxf(0, volume)));
+            auto player = new SuperpoweredAdvancedAudioPlayer(info, playerEventCallback, lastSamplerate, 0);
             if (fileLength)
-                info->player->open(fullPath.c_str(), fileOffset, fileLength);
+                player->open(fullPath.c_str(), fileOffset, fileLength);
             else
-                info->player->open(fullPath.c_str());
+                player->open(fullPath.c_str());
+            voices.players[info->id] = player;
             info->closeWhenDone = closeAtFinish;
+            info->limit = limit;
+            info->openOrder = ++openCount;
             id = info->id;
-            setVolume(id, volume);
             setLoop(id, loop);
-            break;
-        }
+        } while (false);
       }
     }
 
@@ -320,42 +1613,374 @@ static void playerEventCallback(void *clientdata, SuperpoweredAdvancedAudioPlaye
 }
 
 /*static*/ void SuperAudio::setVolume(int audioID, float volume) {
-    auto info = getInfoForId(audioID);
-    if (info) info->volume = fminf(1, fmaxf(0, volume));
+    TRAP_ALLOCATIONS;
+    rampTo(audioID, AudioParameter::Volume, volume, 0);
 }
 
 /*static*/ float SuperAudio::getVolume(int audioID) {
     auto info = getInfoForId(audioID);
-    if (info) return info->volume;
+    if (info) return info->targets[RampVolume];
     return 0.5f;
 }
 
-/*static*/ void SuperAudio::setLoop(int audioID, bool loop) {
+/*static*/ void SuperAudio::setPan(int audioID, float pan) {
+    TRAP_ALLOCATIONS;
+    rampTo(audioID, AudioParameter::Pan, pan, 0);
+}
+
+/*static*/ float SuperAudio::getPan(int audioID) {
+    auto info = getInfoForId(audioID);
+    if (info) return info->targets[RampPan];
+    return 0;
+}
+
+/*static*/ void SuperAudio::setRate(int audioID, float rate) {
+    TRAP_ALLOCATIONS;
+    rampTo(audioID, AudioParameter::Rate, rate, 0);
+}
+
+/*static*/ float SuperAudio::getRate(int audioID) {
     auto info = getInfoForId(audioID);
-    if (info && info->player) {
+    if (info) return info->targets[RampRate];
+    return 1;
+}
+
+/*static*/ void SuperAudio::setListenerPosition(float x, float y) {
+    listenerX = x;
+    listenerY = y;
+}
+
+/*static*/ void SuperAudio::setSourcePosition(int audioID, float x, float y) {
+    if (getInfoForId(audioID)) {
+        voices.sourceX[audioID] = x;
+        voices.sourceY[audioID] = y;
+        voices.positional[audioID] = 1;
+    }
+}
+
+/*static*/ void SuperAudio::setNonPositional(int audioID) {
+    if (getInfoForId(audioID)) voices.positional[audioID] = 0;
+}
+
+/*static*/ void SuperAudio::setDistanceAttenuation(int audioID, float minDistance, float maxDistance, float rolloff) {
+    if (getInfoForId(audioID)) {
+        minDistance = fmaxf(0.001f, minDistance);
+        voices.minDistances[audioID] = minDistance;
+        voices.maxDistances[audioID] = fmaxf(minDistance, maxDistance);
+        voices.rolloffs[audioID] = fmaxf(0, rolloff);
+    }
+}
+
+/*static*/ int SuperAudio::addSendBus(BusEffect effect, float returnLevel) {
+    auto bus = sendBusCount.load(std::memory_order_relaxed);
+    if (bus >= MAX_SENDBUSES || !lazyInit()) return -1;
+
+    auto &sendBus = sendBuses[bus];
+    switch (effect) {
+        case BusEffect::Reverb:
+            sendBus.reverb = new SuperpoweredReverb(lastSamplerate);
+            sendBus.reverb->setMix(1.0f); // wet only, since dry signal is mixed directly
+            sendBus.reverb->enable(true);
+            break;
+        case BusEffect::LowPass:
+        case BusEffect::HighPass:
+            sendBus.filter = new SuperpoweredFilter(effect == BusEffect::LowPass ? SuperpoweredFilter_Resonant_Lowpass : SuperpoweredFilter_Resonant_Highpass, lastSamplerate);
+            sendBus.filter->setResonantParameters(effect == BusEffect::LowPass ? 1000.0f : 200.0f, 0.1f);
+            sendBus.filter->enable(true);
+            break;
+    }
+    sendBus.buffer = (float *)allocAligned(outputBufferBytes);
+    sendBus.returnLevel = fmaxf(0, returnLevel);
+    sendBusCount.store(bus + 1, std::memory_order_release); // now the audio thread can use it
+    return bus;
+}
+
+/*static*/ void SuperAudio::setBusReturn(int bus, float level) {
+    if (bus >= 0 && bus < sendBusCount) sendBuses[bus].returnLevel = fmaxf(0, level);
+}
+
+/*static*/ void SuperAudio::setBusReverb(int bus, float roomSize, float damp) {
+    if (bus >= 0 && bus < sendBusCount && sendBuses[bus].reverb) {
+        sendBuses[bus].reverb->setRoomSize(fminf(1, fmaxf(0, roomSize)));
+        sendBuses[bus].reverb->setDamp(fminf(1, fmaxf(0, damp)));
+    }
+}
+
+/*static*/ void SuperAudio::setBusFilter(int bus, float frequency, float resonance) {
+    if (bus >= 0 && bus < sendBusCount && sendBuses[bus].filter)
+        sendBuses[bus].filter->setResonantParameters(frequency, resonance);
+}
+
+/*static*/ void SuperAudio::setSend(int audioID, int bus, float level) {
+    if (getInfoForId(audioID) && bus >= 0 && bus < MAX_SENDBUSES)
+        voices.sends[bus*voices.capacity + audioID] = fmaxf(0, level);
+}
+
+/*static*/ void SuperAudio::setDryLevel(int audioID, float level) {
+    if (getInfoForId(audioID)) voices.dryLevels[audioID] = fminf(1, fmaxf(0, level));
+}
+
+/*static*/ void SuperAudio::setMasterCompressor(bool enabled, float thresholdDb, float ratio, float attackSec, float releaseSec) {
+    if (!lazyInit()) return;
+    masterCompressor->thresholdDb = thresholdDb;
+    masterCompressor->ratio = ratio;
+    masterCompressor->attackSec = attackSec;
+    masterCompressor->releaseSec = releaseSec;
+    masterCompressor->enable(enabled);
+}
+
+/*static*/ void SuperAudio::setMasterLimiter(bool enabled, float ceilingDb, float thresholdDb) {
+    if (!lazyInit()) return;
+    masterLimiter->ceilingDb = ceilingDb;
+    masterLimiter->thresholdDb = thresholdDb;
+    masterLimiter->enable(enabled);
+}
+
+/*static*/ void SuperAudio::setMeteringEnabled(bool enabled) {
+    meteringEnabled = enabled;
+}
+
+/*static*/ bool SuperAudio::getMeter(int audioID, float &peak, float &rms) {
+    if (!getPlayerForId(audioID)) return false;
+    peak = voices.meterPeaks[audioID].load(std::memory_order_relaxed);
+    rms = voices.meterRms[audioID].load(std::memory_order_relaxed);
+    return true;
+}
+
+/*static*/ void SuperAudio::getMasterMeter(float &peak, float &rms) {
+    peak = masterPeak.load(std::memory_order_relaxed);
+    rms = masterRms.load(std::memory_order_relaxed);
+}
+
+/*static*/ bool SuperAudio::setSpectrumEnabled(bool enabled) {
+    if (enabled == spectrumThread.joinable()) return true; // no change
+    if (enabled) {
+        if (!lazyInit()) return false;
+        if (spectrumBands.size() == 0) { // first time: kept afterwards, since the audio thread may still be writing
+            if (!spectrumTap.allocate(4 << SPECTRUM_LOGSIZE) || !spectrumBands.allocate(SpectrumBands)) return false;
+        }
+        spectrumEnabled = true;
+        spectrumThread = std::thread(analyzeSpectrum);
+    } else {
+        spectrumEnabled = false;
+        spectrumThread.join();
+    }
+    return true;
+}
+
+/*static*/ int SuperAudio::getSpectrum(float *bands, int maxBands) {
+    auto count = maxBands < SpectrumBands ? maxBands : (int)SpectrumBands;
+    if (!spectrumThread.joinable() || !spectrumBands.read(bands, 0, count)) return 0;
+    return count;
+}
+
+/*static*/ void SuperAudio::playMusic(const std::string &filePath, float crossfadeSeconds) {
+    if (!lazyInit()) return;
+    clearMusicPlaylist(); // the current track keeps playing until this one has loaded
+    MusicTrack track = { filePath, fmaxf(0, crossfadeSeconds), true };
+    musicPlaylist.push_back(track);
+    updateMusic(); // start loading now, rather than next frame
+}
+
+/*static*/ void SuperAudio::queueMusic(const std::string &filePath, float crossfadeSeconds) {
+    if (!lazyInit()) return;
+    MusicTrack track = { filePath, fmaxf(0, crossfadeSeconds), false };
+    musicPlaylist.push_back(track);
+    musicFailures = 0; // give the playlist another pass
+    updateMusic();
+}
+
+/*static*/ void SuperAudio::stopMusic(float fadeSeconds) {
+    clearMusicPlaylist();
+    updateMusic(); // in case the armed track just started
+    auto current = musicCurrent.exchange(-1);
+    if (musicArmedID >= 0) { // claimed by the audio thread, which was starting it
+        if (current == musicArmedID) musicArmedID = -1; // published just now, after updateMusic() looked
+        else musicArmedStopFade = fmaxf(0, fadeSeconds); // stopped by updateMusic() once published
+    }
+    if (musicObservedID >= 0 && musicObservedID != current) stopAndClose(musicObservedID); // ending anyway
+    musicObservedID = -1;
+    if (current >= 0) stopMusicTrack(current, fadeSeconds);
+}
+
+/*static*/ void SuperAudio::setMusicRepeat(bool repeat) {
+    musicRepeat = repeat;
+}
+
+/*static*/ void SuperAudio::setMusicVolume(float volume) {
+    volume = fminf(1, fmaxf(0, volume));
+    musicVolume = volume;
+    auto current = musicCurrent.load();
+    if (current >= 0) setVolume(current, volume);
+}
+
+/*static*/ float SuperAudio::getMusicVolume() {
+    return musicVolume;
+}
+
+/*static*/ int SuperAudio::getMusicID() {
+    return musicCurrent;
+}
+
+/*static*/ unsigned int SuperAudio::bounce(const std::vector<BounceSound> &sounds, float seconds, std::vector<float> &samples, int threads) {
+    samples.clear();
+    if (sounds.empty() || !lazyInit()) return 0; // initialized for APKPath and the samplerate
+
+    // find files here, since Android's lookup needs the Cocos thread
+    std::vector<BounceSource> sources(sounds.size());
+    for (size_t i=0; i < sounds.size(); i++) {
+        sources[i].sound = &sounds[i];
+        if (!resolvePath(sounds[i].filePath, sources[i].fullPath, sources[i].fileOffset, sources[i].fileLength)) {
+            CCLOG("SuperAudio bounce: %s not found", sounds[i].filePath.c_str());
+            return 0;
+        }
+    }
+
+    // split the sounds into groups, each rendered by its own thread, then summed
+    auto groupCount = threads < 1 ? 1 : (threads > (int)sources.size() ? (int)sources.size() : threads);
+    std::vector<std::vector<BounceSource>> groups(groupCount);
+    for (size_t i=0; i < sources.size(); i++) groups[i % groupCount].push_back(sources[i]);
+    std::vector<std::vector<float>> outputs(groupCount);
+    std::vector<char> rendered(groupCount, false);
+    auto frames = seconds > 0 ? (unsigned int)(seconds * lastSamplerate) : 0;
+    auto render = [&](int g) {
+        rendered[g] = renderBounce(groups[g].data(), (int)groups[g].size(), frames, lastSamplerate, outputs[g]);
+    };
+    std::vector<std::thread> workers;
+    for (auto g=1; g < groupCount; g++) workers.push_back(std::thread(render, g));
+    render(0);
+    for (auto &worker : workers) worker.join();
+
+    for (auto g=0; g < groupCount; g++) {
+        if (!rendered[g]) return 0;
+        if (outputs[g].size() > samples.size()) samples.swap(outputs[g]); // keep the longest
+    }
+    for (auto g=0; g < groupCount; g++) {
+        if (outputs[g].empty()) continue;
+        SuperpoweredVolumeAdd(outputs[g].data(), samples.data(), 1, 1, (unsigned int)(outputs[g].size() / 2));
+    }
+    return (unsigned int)(samples.size() / 2);
+}
+
+/*static*/ bool SuperAudio::bounceToFile(const std::vector<BounceSound> &sounds, float seconds, const std::string &wavPath, int threads) {
+    std::vector<float> samples;
+    auto frames = bounce(sounds, seconds, samples, threads);
+    if (frames == 0) return false;
+
+    auto file = fopen(wavPath.c_str(), "wb");
+    if (file == nullptr) return false;
+    auto ok = writeWavHeader(file, lastSamplerate, false, frames * 4);
+    short int converted[BOUNCE_BLOCKSIZE * 2];
+    for (unsigned int done=0; ok && done < frames; done += BOUNCE_BLOCKSIZE) {
+        auto n = frames - done < BOUNCE_BLOCKSIZE ? frames - done : BOUNCE_BLOCKSIZE;
+        SuperpoweredFloatToShortInt(&samples[done * 2], converted, n);
+        ok = fwrite(converted, sizeof(short int) * 2, n, file) == n;
+    }
+    if (fclose(file) != 0) ok = false;
+    if (!ok) remove(wavPath.c_str());
+    return ok;
+}
+
+/*static*/ bool SuperAudio::startCapture(const std::string &filePath, bool wav) {
+    if (captureThread.joinable()) return false; // already capturing
+    if (!lazyInit()) return false;
+    if (captureRing.capacity() == 0) { // first time: kept afterwards, since the audio thread may still be writing
+        if (!captureRing.allocate(CAPTURE_SECONDS * lastSamplerate * 2)) return false;
+    }
+    captureRing.discard(); // anything written as the last capture stopped
+    captureFile = fopen(filePath.c_str(), "wb");
+    if (captureFile == nullptr) return false;
+    captureIsWav = wav;
+    captureSamplerate = lastSamplerate;
+    if (wav && !writeWavHeader(captureFile, captureSamplerate, true, 0)) { // sizes are set by stopCapture()
+        fclose(captureFile);
+        captureFile = nullptr;
+        return false;
+    }
+    captureBytes = 0;
+    captureFailed = false;
+    captureFull = false;
+    captureOverflows = 0;
+    capturing = true;
+    captureThread = std::thread(writeCapture);
+    return true;
+}
+
+/*static*/ bool SuperAudio::stopCapture() {
+    if (!captureThread.joinable()) return false; // not capturing
+    capturing = false;
+    captureThread.join();
+    auto ok = !captureFailed && !captureFull;
+    if (captureIsWav && !captureFailed) {
+        if (fseek(captureFile, 0, SEEK_SET) != 0 || !writeWavHeader(captureFile, captureSamplerate, true, captureBytes)) ok = false;
+    }
+    if (fclose(captureFile) != 0) ok = false;
+    captureFile = nullptr;
+    if (captureOverflows > 0)
+        CCLOG("SuperAudio capture dropped %u samples, since the file couldn't be written fast enough", captureOverflows.load());
+    if (captureFull)
+        CCLOG("SuperAudio capture stopped early, at the 4 GB size limit of WAV files");
+    return ok;
+}
+
+/*static*/ unsigned int SuperAudio::getCaptureOverflowCount() {
+    return captureOverflows;
+}
+
+/*static*/ unsigned int SuperAudio::getSamplerate() {
+    lazyInit(); // the device's samplerate is known once initialized
+    return lastSamplerate;
+}
+
+/*static*/ void SuperAudio::fadeTo(int audioID, float volume, float seconds, FadeCurve curve, FinishCallback callback) {
+    TRAP_ALLOCATIONS;
+    rampTo(audioID, AudioParameter::Volume, volume, seconds, curve, std::move(callback));
+}
+
+/*static*/ void SuperAudio::rampTo(int audioID, AudioParameter parameter, float target, float seconds, FadeCurve curve, FinishCallback callback) {
+    TRAP_ALLOCATIONS;
+    switch (parameter) {
+        case AudioParameter::Volume: target = fminf(1, fmaxf(0, target)); break;
+        case AudioParameter::Pan: target = fminf(1, fmaxf(-1, target)); break;
+        case AudioParameter::Rate: target = fminf(4, fmaxf(0.25f, target)); break;
+    }
+    requestRamp(audioID, (int)parameter, target, seconds, curve, std::move(callback));
+}
+
+/*static*/ void SuperAudio::setLoop(int audioID, bool loop) {
+    auto player = getPlayerForId(audioID);
+    if (player) {
         if (loop) 
-            info->player->loop(0.0, (double)info->player->durationMs, false, 255, false);
+            player->loop(0.0, (double)player->durationMs, false, 255, false);
         else
-            info->player->exitLoop();
+            player->exitLoop();
+        transportChanged(audioID);
     }
 }
 
 /*static*/ bool SuperAudio::isLoop(int audioID) {
-    auto info = getInfoForId(audioID);
-    if (info && info->player) return info->player->looping;
+    auto player = getPlayerForId(audioID);
+    if (player) {
+        AudioState state;
+        readStates(audioID, 1, &state);
+        return state.looping;
+    }
     return false;
 }
 
-/*static*/ void SuperAudio::playFromStart(int audioID, const std::function<void()> &callback) {
+/*static*/ void SuperAudio::playFromStart(int audioID, FinishCallback callback) {
+    TRAP_ALLOCATIONS;
     setCurrentTime(audioID, 0);
-    setFinishCallback(audioID, callback);
+    setFinishCallback(audioID, std::move(callback));
     resume(audioID);
 }
 
 /*static*/ void SuperAudio::pause(int audioID) {
-    auto info = getInfoForId(audioID);
-    if (info && info->player) {
-        info->player->pause();
+    TRAP_ALLOCATIONS;
+    auto player = getPlayerForId(audioID);
+    if (player) {
+        player->pause();
+        transportChanged(audioID);
 #if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
         SuperpoweredCPU::setSustainedPerformanceMode(false);
 #endif
@@ -364,14 +1989,16 @@ static void playerEventCallback(void *clientdata, SuperpoweredAdvancedAudioPlaye
 
 /*static*/ void SuperAudio::pauseAll() {
     if (outputBuffer == nullptr) return; // not initial;izeds
-    for (auto i=0; i < MAX_AUDIOINSTANCES; i++)
+    for (auto i=0; i < voices.capacity; i++)
         pause(i);
 }
 
 /*static*/ void SuperAudio::resume(int audioID) {
-    auto info = getInfoForId(audioID);
-    if (info && info->player) {
-        info->player->play(false);
+    TRAP_ALLOCATIONS;
+    auto player = getPlayerForId(audioID);
+    if (player) {
+        player->play(false);
+        transportChanged(audioID);
 #if CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
         SuperpoweredCPU::setSustainedPerformanceMode(true);
 #endif
@@ -380,68 +2007,91 @@ static void playerEventCallback(void *clientdata, SuperpoweredAdvancedAudioPlaye
 
 /*static*/ void SuperAudio::resumeAll() {
     if (outputBuffer == nullptr) return; // not initialized
-    for (auto i=0; i < MAX_AUDIOINSTANCES; i++)
+    for (auto i=0; i < voices.capacity; i++)
         resume(i);
 }
 
 /*static*/ void SuperAudio::stopAndClose(int audioID) {
+    TRAP_ALLOCATIONS;
     pause(audioID);
     closePlayer(audioID);
 }
 
 /*static*/ void SuperAudio::stopAndCloseAll() {
     if (outputBuffer == nullptr) return; // not initialized
-    for (auto i=0; i < MAX_AUDIOINSTANCES; i++)
+    for (auto i=0; i < voices.capacity; i++)
         stopAndClose(i);
 }
 
 /*static*/ float SuperAudio::getDuration(int audioID) {
-    auto info = getInfoForId(audioID);
-    if (info && info->player) {
-        if (info->nowLoading) return -1;
-        return (float)((double)info->player->durationMs / 1000.0);
+    auto player = getPlayerForId(audioID);
+    if (player) {
+        AudioState state;
+        readStates(audioID, 1, &state);
+        return state.duration;
     }
     return -1; // nothing to return
 }
 
 /*static*/ float SuperAudio::getCurrentTime(int audioID) {
-    auto info = getInfoForId(audioID);
-    if (info && info->player)
-        return (float)(info->player->displayPositionMs / 1000.0);
+    auto player = getPlayerForId(audioID);
+    if (player) {
+        AudioState state;
+        readStates(audioID, 1, &state);
+        return state.currentTime;
+    }
     return -1; // nothing to return
 }
 
 /*static*/ bool SuperAudio::setCurrentTime(int audioID, float sec) {
-    auto info = getInfoForId(audioID);
-    if (info && info->player) {
-        if (info->nowLoading) return false; // can't seek yet
-        info->player->setPosition(sec*1000.0, true, false);
+    auto player = getPlayerForId(audioID);
+    if (player) {
+        if (voices.info[audioID].nowLoading) return false; // can't seek yet
+        player->setPosition(sec*1000.0, true, false);
+        transportChanged(audioID);
         return true;
     }
     return false;
 }
 
 /*static*/ bool SuperAudio::isPlaying(int audioID) {
-    auto info = getInfoForId(audioID);
-    if (info && info->player) return info->player->playing;
+    auto player = getPlayerForId(audioID);
+    if (player) {
+        AudioState state;
+        readStates(audioID, 1, &state);
+        return state.playing;
+    }
     return false;
 }
 
-/*static*/ void SuperAudio::setFinishCallback(int audioID, const std::function<void()> &callback) {
+/*static*/ int SuperAudio::getStates(AudioState *states, int maxStates) {
+    if (outputBuffer == nullptr) return 0; // not initialized
+    auto count = maxStates < voices.capacity ? maxStates : voices.capacity;
+    if (count <= 0) return 0;
+    convertStates(voiceStates.read(voiceStatesCopy, 0, count) ? voiceStatesCopy : nullptr, 0, count, states); // all from one buffer
+    return count;
+}
+
+/*static*/ void SuperAudio::setFinishCallback(int audioID, FinishCallback callback) {
+    TRAP_ALLOCATIONS;
     auto info = getInfoForId(audioID);
-    if (info) info->callbackWhenDone = callback;
+    if (info) info->callbackWhenDone = std::move(callback); // moved, since copying a std::function can allocate
 }
 
 /*static*/ int SuperAudio::getMaxAudioInstances() {
-    return MAX_AUDIOINSTANCES;
+    return voices.capacity ? voices.capacity : DEFAULT_AUDIOINSTANCES;
 }
 
 /*static*/ int SuperAudio::getPlayingAudioCount() {
     int count = 0;
     if (outputBuffer == nullptr) return 0; // not initialized
-    for (auto info=playerInfo; info < &playerInfo[MAX_AUDIOINSTANCES]; info++) {
-        if (info->player && info->player->playing)
-            count++;
+    AudioState states[32];
+    for (auto first=0; first < voices.capacity; first += 32) {
+        auto n = voices.capacity - first < 32 ? voices.capacity - first : 32;
+        readStates(first, n, states);
+        for (auto j=0; j < n; j++) {
+            if (states[j].playing) count++;
+        }
     }
     return count;
 }
@@ -43,26 +43,127 @@
 #if (CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID)
 #include <map> // for std:: definitions
 #endif // CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID
+#include <string>
+#include <vector>
+#include "SuperAudioCallback.h"
 
 class SuperAudio {
 public:
+    /** Number of bands returned by getSpectrum(). */
+    static const int SpectrumBands = 64;
+
+    /**
+     * Callbacks are stored inline (never on the heap), so they can capture at most
+     * 6 pointers' worth of data.  Lambdas and std::function objects convert implicitly,
+     * and SuperAudio only moves them after that, so it never allocates to store one.
+     * Converting a std::function copies it, though, which may allocate (before the call).
+     */
+    typedef SuperAudioCallback<void(int id, bool isSuccess)> OpenCallback;
+    typedef SuperAudioCallback<void()> FinishCallback;
+
+    /**
+     * What open() does when a sound already has its maximum number of instances.
+     */
+    enum class InstancePolicy {
+        RestartOldest, // rewind the instance that was opened longest ago and return its audioID
+        IgnoreNew,     // leave the existing instances alone, and open() returns -1
+        StealQuietest  // rewind the instance heard most quietly (after volume, pan and distance) and return its audioID
+    };
+
+    /**
+     * Initialize SuperAudio with a voice pool of the given size.  Optional: otherwise the first
+     * open() initializes it with 24 voices.  Call end() first to change the size of the pool.
+     *
+     * @param maxAudioInstances The maximum number of simultaneous audio instances.
+     * @return true if SuperAudio is initialized with that many voices.
+     */
+    static bool init(int maxAudioInstances = 24);
+
+    /**
+     * Shape of a fade or ramp made by fadeTo() or rampTo().
+     */
+    enum class FadeCurve {
+        Linear,
+        EqualPower,  // sine/cosine, for crossfades with no dip in loudness
+        Exponential, // equal steps in decibels (linear for negative values)
+        SCurve       // slow start and end
+    };
+
+    /**
+     * A per-instance parameter that can be ramped by rampTo().
+     */
+    enum class AudioParameter {
+        Volume, // 0.0 to 1.0
+        Pan,    // -1.0 (left) to 1.0 (right)
+        Rate    // playback rate (and pitch), 0.25 to 4.0
+    };
+
+    /**
+     * The shared effect of a send bus created by addSendBus().
+     */
+    enum class BusEffect {
+        Reverb,
+        LowPass,
+        HighPass
+    };
+
+    /**
+     * The state of an audio instance, as returned by getStates().
+     */
+    struct AudioState {
+        bool open; // false if the audioID isn't open (the other values are then false or -1)
+        bool playing; // see isPlaying()
+        bool looping; // see isLoop()
+        float currentTime; // see getCurrentTime()
+        float duration; // see getDuration()
+        double audioTime; // seconds of audio output when this state was current (0 before the first)
+    };
+
+    /**
+     * A sound to be mixed by bounce() or bounceToFile().
+     */
+    struct BounceSound {
+        std::string filePath; // as for open()
+        float startTime; // seconds from the start of the bounce
+        float volume; // 0.0 to 1.0
+        float pan; // -1.0 (left) to 1.0 (right)
+        float rate; // 0.25 to 4.0
+        BounceSound(const std::string &filePath, float startTime = 0, float volume = 1, float pan = 0, float rate = 1)
+            : filePath(filePath), startTime(startTime), volume(volume), pan(pan), rate(rate) {}
+    };
+
     /**
      * Release objects relating to SuperAudio.
      */
     static void end();
     
+    /**
+     * Limit the number of simultaneous instances of a sound, so rapid-fire effects reuse
+     * their already-loaded instances instead of opening a new one for every trigger.
+     * While a sound has a limit, its finished instances are kept loaded (instead of closed)
+     * until they are triggered again, or until their slot is needed for another sound.
+     *
+     * @param filePath The path of the audio file, exactly as it is passed to open().
+     * @param maxInstances The maximum number of instances (0 removes the limit).
+     * @param policy What open() does when the limit has been reached.
+     */
+    static void setInstanceLimit(const std::string &filePath, int maxInstances, InstancePolicy policy = InstancePolicy::RestartOldest);
+    
     /**
      * Open an audio instance.
      *
      * @param filePath The path of a 2d audio file of at least 1/10 second in length.
+     *        On Android, only its name is used to find it in res/raw, unless the path is absolute.
      * @param loop Whether or not the audio instance loops to the beginning.
      * @param volume Volume value (range from 0.0 to 1.0).
      * @param closeAtFinish Whether or not to automatically close when it's done playing.
      * @param callback Tells whether the file was able to open successfully.  This callback is needed if you
      *        are going to call getDuration() or setCurrentTime(), since they fail until open() has succeeded.
-     * @return An audio ID (or 0 if bad filePath). It allows you to affect the behavior of an audio instance.
+     * @return An audio ID (or -1 if bad filePath, no free instance, or an instance limit with IgnoreNew policy).
+     *         It allows you to affect the behavior of an audio instance.  If the file has an instance limit,
+     *         this may be the audioID of an existing instance which has been rewound (see setInstanceLimit).
      */
-    static int open(const std::string &filePath, bool loop=false, float volume=0.5f, bool closeAtFinish=true, const std::function<void(int id, bool isSuccess)> &callback = nullptr);
+    static int open(const std::string &filePath, bool loop=false, float volume=0.5f, bool closeAtFinish=true, OpenCallback callback = nullptr);
     
     /**
      * Start playing the opened audio instance from beginning.
@@ -70,7 +171,7 @@ public:
      * @param audioID An audioID returned from open.
      * @param callback Invoked when the audio instance has completed playing.
      */
-    static void playFromStart(int audioID, const std::function<void()> &callback = nullptr);
+    static void playFromStart(int audioID, FinishCallback callback = nullptr);
     
     /**
      * Sets whether an audio instance loops or not.
@@ -100,10 +201,335 @@ public:
      * Gets the volume value of an audio instance.
      *
      * @param audioID An audioID returned from open.
-     * @return Volume value (range from 0.0 to 1.0).
+     * @return Volume value (range from 0.0 to 1.0), or the target volume if fading.
      */
     static float getVolume(int audioID);
     
+    /**
+     * Sets the stereo pan of an audio instance.
+     *
+     * @param audioID An audioID returned from open.
+     * @param pan Pan value (range from -1.0 for left to 1.0 for right).
+     */
+    static void setPan(int audioID, float pan);
+    
+    /**
+     * Gets the stereo pan of an audio instance.
+     *
+     * @param audioID An audioID returned from open.
+     * @return Pan value (range from -1.0 to 1.0), or the target pan if ramping.
+     */
+    static float getPan(int audioID);
+    
+    /**
+     * Sets the playback rate of an audio instance, which also changes its pitch.
+     *
+     * @param audioID An audioID returned from open.
+     * @param rate Playback rate (range from 0.25 to 4.0, 1.0 is normal).
+     */
+    static void setRate(int audioID, float rate);
+    
+    /**
+     * Gets the playback rate of an audio instance.
+     *
+     * @param audioID An audioID returned from open.
+     * @return Playback rate, or the target rate if ramping.
+     */
+    static float getRate(int audioID);
+    
+    /**
+     * Sets the position of the listener, for audio instances positioned by setSourcePosition().
+     *
+     * @param x Listener position in game units (such as points).
+     * @param y Listener position in game units.
+     */
+    static void setListenerPosition(float x, float y);
+    
+    /**
+     * Positions an audio instance, so that it is panned and attenuated by its distance from
+     * the listener (in addition to its own volume and pan).  Call again whenever it moves.
+     *
+     * @param audioID An audioID returned from open.
+     * @param x Source position in game units.
+     * @param y Source position in game units.
+     */
+    static void setSourcePosition(int audioID, float x, float y);
+    
+    /**
+     * Stops positioning an audio instance (its default after open).
+     *
+     * @param audioID An audioID returned from open.
+     */
+    static void setNonPositional(int audioID);
+    
+    /**
+     * Sets how a positioned audio instance is attenuated with distance from the listener:
+     * gain = minDistance / (minDistance + rolloff * (distance - minDistance)),
+     * with distance clamped to the range minDistance to maxDistance.
+     *
+     * @param audioID An audioID returned from open.
+     * @param minDistance Distance within which there is no attenuation (default 1).
+     * @param maxDistance Distance beyond which there is no further attenuation (default 1000).
+     * @param rolloff How quickly it is attenuated (default 1, 0 for none).
+     */
+    static void setDistanceAttenuation(int audioID, float minDistance, float maxDistance, float rolloff = 1);
+    
+    /**
+     * Creates a send bus: one shared effect which any audio instance can send to with setSend(),
+     * so the effect is processed once per audio buffer no matter how many instances use it.
+     * Up to 4 send buses can be created, and they last until end().
+     *
+     * @param effect The bus's effect.
+     * @param returnLevel Level of the effect's output in the mix.
+     * @return The bus number (or -1 if there are already 4 buses).
+     */
+    static int addSendBus(BusEffect effect, float returnLevel = 1.0f);
+    
+    /**
+     * Sets the level of a send bus's effect output in the mix.
+     *
+     * @param bus A bus number returned from addSendBus.
+     * @param level Return level (0.0 for none, 1.0 for unity).
+     */
+    static void setBusReturn(int bus, float level);
+    
+    /**
+     * Sets the parameters of a reverb send bus.
+     *
+     * @param bus A bus number returned from addSendBus(BusEffect::Reverb).
+     * @param roomSize Room size (range from 0.0 to 1.0).
+     * @param damp High frequency damping (range from 0.0 to 1.0).
+     */
+    static void setBusReverb(int bus, float roomSize, float damp);
+    
+    /**
+     * Sets the parameters of a low-pass or high-pass send bus.
+     *
+     * @param bus A bus number returned from addSendBus(BusEffect::LowPass or HighPass).
+     * @param frequency Cutoff frequency in Hz.
+     * @param resonance Resonance (see SuperpoweredFilter.h for its range).
+     */
+    static void setBusFilter(int bus, float frequency, float resonance = 0.1f);
+    
+    /**
+     * Sets how much of an audio instance is sent to a send bus.  The send follows the instance's
+     * volume, pan and position, but not its dry level.
+     *
+     * @param audioID An audioID returned from open.
+     * @param bus A bus number returned from addSendBus.
+     * @param level Send level (0.0 for none, 1.0 for unity).
+     */
+    static void setSend(int audioID, int bus, float level);
+    
+    /**
+     * Sets how much of an audio instance is mixed directly (not through a send bus) into the output.
+     * For example, send it fully to a low-pass bus with a dry level of 0.0 to muffle it.
+     *
+     * @param audioID An audioID returned from open.
+     * @param level Dry level (range from 0.0 to 1.0, the default).
+     */
+    static void setDryLevel(int audioID, float level);
+    
+    /**
+     * Enables or disables a compressor on the final mix.
+     *
+     * @param enabled Whether the compressor is applied.
+     * @param thresholdDb Level above which it compresses.
+     * @param ratio Compression ratio.
+     * @param attackSec Attack time in seconds.
+     * @param releaseSec Release time in seconds.
+     */
+    static void setMasterCompressor(bool enabled, float thresholdDb = -12.0f, float ratio = 3.0f, float attackSec = 0.003f, float releaseSec = 0.3f);
+    
+    /**
+     * Enables or disables a limiter on the final mix (after the compressor).
+     *
+     * @param enabled Whether the limiter is applied.
+     * @param ceilingDb Maximum output level.
+     * @param thresholdDb Level above which it limits.
+     */
+    static void setMasterLimiter(bool enabled, float ceilingDb = -0.3f, float thresholdDb = -1.0f);
+    
+    /**
+     * Plays a music track in place of the current one (and of any queued ones).  The track is
+     * loaded in the background, and the current track keeps playing until it's ready, so there
+     * is no silence while loading.
+     *
+     * @param filePath The path of the audio file.
+     * @param crossfadeSeconds Crossfade from the current track, or 0 to switch at once.
+     */
+    static void playMusic(const std::string &filePath, float crossfadeSeconds = 0);
+    
+    /**
+     * Adds a music track to the end of the playlist.  The next track is loaded while the
+     * current one plays, then started by the mixer where the current one ends (minus any
+     * crossfade), so tracks play back to back with no gap.  The splice is accurate to within
+     * a millisecond, since that's the resolution of the players' durations.  If no music is
+     * playing, the track starts as soon as it's loaded.
+     *
+     * @param filePath The path of the audio file.
+     * @param crossfadeSeconds Crossfade from the previous track, or 0 to play gaplessly.
+     */
+    static void queueMusic(const std::string &filePath, float crossfadeSeconds = 0);
+    
+    /**
+     * Stops the music and clears the playlist.
+     *
+     * @param fadeSeconds Fade out time, or 0 to stop at once.
+     */
+    static void stopMusic(float fadeSeconds = 0);
+    
+    /**
+     * Sets whether the playlist starts over after its last track (false by default).  If a whole
+     * pass of the playlist fails to open, it stops until queueMusic() or playMusic() is called.
+     */
+    static void setMusicRepeat(bool repeat);
+    
+    /**
+     * Sets the volume of the music, including tracks that haven't started yet.
+     *
+     * @param volume Volume from 0.0 to 1.0 (default 0.5).
+     */
+    static void setMusicVolume(float volume);
+    
+    /** Gets the volume set by setMusicVolume(). */
+    static float getMusicVolume();
+    
+    /**
+     * Gets the audioID of the music track now playing, which can be used with setPan(),
+     * getCurrentTime() etc.  Use setMusicVolume() for its volume, though.
+     *
+     * @return An audioID, or -1 if no music is playing.
+     */
+    static int getMusicID();
+    
+    /**
+     * Mixes sounds offline, as fast as possible, with the same mixing as playback (but not the
+     * send buses or master effects).  This is for pre-mixing layered or varied sounds at load
+     * time, so they play as one audio instance instead of many.  Blocks until done.
+     *
+     * @param sounds The sounds, and when each one starts.
+     * @param seconds Length of the mix, or 0 to end with the last sound.
+     * @param samples Set to the mix, as interleaved stereo at getSamplerate().
+     * @param threads Number of threads to mix on, each mixing some of the sounds.
+     * @return The number of stereo samples, or 0 if a sound couldn't be loaded (or decoded in time).
+     */
+    static unsigned int bounce(const std::vector<BounceSound> &sounds, float seconds, std::vector<float> &samples, int threads = 1);
+    
+    /**
+     * Mixes sounds offline into a 16-bit WAV file (see bounce()), which can then be
+     * opened like any other sound.
+     *
+     * @param sounds The sounds, and when each one starts.
+     * @param seconds Length of the mix, or 0 to end with the last sound.
+     * @param wavPath Absolute path of the file to write, such as in Cocos2d-x's
+     *        FileUtils::getWritablePath().
+     * @param threads Number of threads to mix on, each mixing some of the sounds.
+     * @return true if the file was written.
+     */
+    static bool bounceToFile(const std::vector<BounceSound> &sounds, float seconds, const std::string &wavPath, int threads = 1);
+    
+    /**
+     * Starts recording exactly what is sent to the audio output, as 32-bit float stereo.
+     * The audio thread only copies each buffer into memory, and a background thread writes
+     * it to the file, so a slow file system never interrupts the audio.  Instead, buffers
+     * that don't fit are dropped and counted (see getCaptureOverflowCount()).
+     *
+     * @param filePath Absolute path of the file to write, such as in Cocos2d-x's
+     *        FileUtils::getWritablePath().
+     * @param wav Whether to write a WAV file, or just the samples (interleaved, native byte order).
+     * @return false if already capturing, or the file couldn't be created.
+     */
+    static bool startCapture(const std::string &filePath, bool wav = true);
+    
+    /**
+     * Stops recording, after writing everything captured so far.
+     *
+     * @return false if not capturing, or the file couldn't be written.  WAV files can hold about
+     *         3 hours (4 GB) of float samples: a capture that long stops there, returning false here.
+     */
+    static bool stopCapture();
+    
+    /**
+     * Gets the number of stereo samples dropped by the current (or last) capture, because they
+     * were captured faster than they could be written.  0 means the file is a complete recording.
+     */
+    static unsigned int getCaptureOverflowCount();
+    
+    /** Gets the output samplerate, which is also the samplerate of bounces. */
+    static unsigned int getSamplerate();
+    
+    /**
+     * Enables or disables peak and RMS metering of each audio instance and of the final mix.
+     * Metering costs a little CPU per playing instance on the audio thread, so it is off by default.
+     *
+     * @param enabled Whether meters are updated.
+     */
+    static void setMeteringEnabled(bool enabled);
+    
+    /**
+     * Gets the meters of an audio instance, after its volume, pan and position.  Peaks fall back
+     * gradually and RMS is averaged over about 0.1 seconds, so they can be read once per frame.
+     *
+     * @param audioID An audioID returned from open.
+     * @param peak Set to the peak level (1.0 is full scale).
+     * @param rms Set to the RMS level.
+     * @return false if invalid audioID.
+     */
+    static bool getMeter(int audioID, float &peak, float &rms);
+    
+    /**
+     * Gets the meters of the final mix (see getMeter()).
+     *
+     * @param peak Set to the peak level (1.0 is full scale).
+     * @param rms Set to the RMS level.
+     */
+    static void getMasterMeter(float &peak, float &rms);
+    
+    /**
+     * Enables or disables spectrum analysis of the final mix.  While enabled, a background thread
+     * analyzes the mix about 60 times per second, and the audio thread only copies its output.
+     *
+     * @param enabled Whether the spectrum is analyzed.
+     * @return false if the analysis couldn't be started.
+     */
+    static bool setSpectrumEnabled(bool enabled);
+    
+    /**
+     * Gets the latest spectrum of the final mix, without blocking.
+     *
+     * @param bands Set to the level of each log-spaced frequency band, lowest first
+     *        (1.0 for a full-scale sine wave).
+     * @param maxBands Size of bands (SpectrumBands for all of them).
+     * @return The number of bands set (0 if the spectrum isn't enabled or ready).
+     */
+    static int getSpectrum(float *bands, int maxBands);
+    
+    /**
+     * Fades the volume of an audio instance.  The fade is computed by the audio thread,
+     * so it needs no calls from the game loop while it runs.
+     *
+     * @param audioID An audioID returned from open.
+     * @param volume Target volume value (range from 0.0 to 1.0).
+     * @param seconds Length of the fade.
+     * @param curve Shape of the fade.
+     * @param callback Invoked when the fade has completed (not if replaced by another fade or closed).
+     */
+    static void fadeTo(int audioID, float volume, float seconds, FadeCurve curve = FadeCurve::Linear, FinishCallback callback = nullptr);
+    
+    /**
+     * Ramps a parameter of an audio instance, replacing any ramp of that parameter in progress.
+     * Volume and pan are interpolated per sample, rate once per audio buffer.
+     *
+     * @param audioID An audioID returned from open.
+     * @param parameter The parameter to ramp.
+     * @param target Target value (see AudioParameter for ranges).
+     * @param seconds Length of the ramp (0 changes it within one audio buffer).
+     * @param curve Shape of the ramp.
+     * @param callback Invoked when the ramp has completed (not if replaced by another ramp or closed).
+     */
+    static void rampTo(int audioID, AudioParameter parameter, float target, float seconds, FadeCurve curve = FadeCurve::Linear, FinishCallback callback = nullptr);
+    
     /**
      * Pause an audio instance.
      *
@@ -177,10 +603,23 @@ public:
      * @param audioID An audioID returned from open.
      * @param callback
      */
-    static void setFinishCallback(int audioID, const std::function<void()> &callback);
+    static void setFinishCallback(int audioID, FinishCallback callback);
+    
+    /**
+     * Gets the state of every audio instance at once, which is much cheaper than calling
+     * isPlaying(), getCurrentTime() etc. for each one.  Like those, this returns what the
+     * audio thread last published (at most one audio buffer old), so all values of an
+     * instance are consistent with each other.  After play, pause, seek or loop changes,
+     * an instance's values are read directly until the audio thread has seen the change.
+     *
+     * @param states Set to the state of each audioID, indexed by audioID.
+     * @param maxStates Size of states (getMaxAudioInstances() for all of them).
+     * @return The number of states set.
+     */
+    static int getStates(AudioState *states, int maxStates);
     
     /**
-     * Gets the maximum number of simultaneous audio instances of SuperAudio.
+     * Gets the maximum number of simultaneous audio instances of SuperAudio (see init()).
      */
     static int getMaxAudioInstances();
 
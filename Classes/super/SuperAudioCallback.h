@@ -0,0 +1,174 @@
+//
+//  SuperAudioCallback.h
+//
+/****************************************************************************
+ Copyright (c) 2018 David T. Offen
+
+ http://www.doffen.org
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+//  A callback holder like std::function, except that the callable is always stored
+//    inside the object (never on the heap), so storing or copying it never allocates.
+//    Lambdas capturing more than Capacity bytes fail to compile; capture a pointer
+//    to your data instead.
+//  A std::function is stored as is, and its own target may be on the heap: converting
+//    an lvalue std::function copies it (which may allocate, in the caller), and so does
+//    copying a SuperAudioCallback holding one.  Moving never allocates.
+//  Never include any Cocos2d-x or Superpowered include files here, since this is
+//    included by SuperAudio.h.
+
+#ifndef SuperAudioCallback_h
+#define SuperAudioCallback_h
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, std::size_t Capacity = 6 * sizeof(void *)>
+class SuperAudioCallback;
+
+// whether F can be called as R(Args...), so that NULL or 0 converts to an empty callback instead
+template <typename F, typename R, typename... Args>
+struct SuperAudioCallbackIsCallable {
+private:
+    template <typename G>
+    static auto test(int) -> decltype(std::declval<G &>()(std::declval<Args>()...), std::true_type());
+    template <typename G>
+    static std::false_type test(...);
+    template <typename G, bool callable>
+    struct Returns : std::false_type {};
+    template <typename G>
+    struct Returns<G, true> : std::integral_constant<bool, std::is_void<R>::value ||
+        std::is_convertible<decltype(std::declval<G &>()(std::declval<Args>()...)), R>::value> {};
+public:
+    static const bool value = Returns<F, decltype(test<F>(0))::value>::value;
+};
+
+template <typename R, typename... Args, std::size_t Capacity>
+class SuperAudioCallback<R(Args...), Capacity> {
+public:
+    SuperAudioCallback() : ops(nullptr) {}
+    SuperAudioCallback(std::nullptr_t) : ops(nullptr) {}
+
+    // an empty std::function stays empty, so existing callers can pass theirs along
+    SuperAudioCallback(std::function<R(Args...)> function) : ops(nullptr) {
+        if (function) assign(std::move(function));
+    }
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, SuperAudioCallback>::value &&
+        !std::is_same<typename std::decay<F>::type, std::function<R(Args...)>>::value &&
+        SuperAudioCallbackIsCallable<typename std::decay<F>::type, R, Args...>::value>::type>
+    SuperAudioCallback(F &&callable) : ops(nullptr) {
+        assign(std::forward<F>(callable));
+    }
+
+    SuperAudioCallback(const SuperAudioCallback &other) : ops(other.ops) {
+        if (ops) ops->copy(&storage, &other.storage);
+    }
+
+    SuperAudioCallback(SuperAudioCallback &&other) : ops(other.ops) {
+        if (ops) {
+            ops->move(&storage, &other.storage);
+            other.reset();
+        }
+    }
+
+    ~SuperAudioCallback() { reset(); }
+
+    SuperAudioCallback &operator=(const SuperAudioCallback &other) {
+        if (this != &other) {
+            reset();
+            if (other.ops) other.ops->copy(&storage, &other.storage);
+            ops = other.ops;
+        }
+        return *this;
+    }
+
+    SuperAudioCallback &operator=(SuperAudioCallback &&other) {
+        if (this != &other) {
+            reset();
+            if (other.ops) {
+                other.ops->move(&storage, &other.storage);
+                ops = other.ops;
+                other.reset();
+            }
+        }
+        return *this;
+    }
+
+    SuperAudioCallback &operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    explicit operator bool() const { return ops != nullptr; }
+
+    R operator()(Args... args) const {
+        return ops->invoke(&storage, std::forward<Args>(args)...);
+    }
+
+private:
+    struct Ops {
+        R (*invoke)(const void *callable, Args&&... args);
+        void (*copy)(void *to, const void *from);
+        void (*move)(void *to, void *from);
+        void (*destroy)(void *callable);
+    };
+
+    template <typename F>
+    struct OpsFor {
+        static R invoke(const void *callable, Args&&... args) {
+            return (*(F *)callable)(std::forward<Args>(args)...);
+        }
+        static void copy(void *to, const void *from) { new (to) F(*(const F *)from); }
+        static void move(void *to, void *from) { new (to) F(std::move(*(F *)from)); }
+        static void destroy(void *callable) { ((F *)callable)->~F(); }
+        static const Ops *get() {
+            static const Ops ops = { &invoke, &copy, &move, &destroy };
+            return &ops;
+        }
+    };
+
+    template <typename F>
+    void assign(F &&callable) {
+        typedef typename std::decay<F>::type Callable;
+        static_assert(sizeof(Callable) <= Capacity, "SuperAudioCallback: callable is too large, capture less");
+        static_assert(alignof(Callable) <= alignof(Storage), "SuperAudioCallback: callable is over-aligned");
+        new (&storage) Callable(std::forward<F>(callable));
+        ops = OpsFor<Callable>::get();
+    }
+
+    void reset() {
+        if (ops) {
+            ops->destroy(&storage);
+            ops = nullptr;
+        }
+    }
+
+    typedef typename std::aligned_storage<Capacity, alignof(double)>::type Storage;
+    Storage storage;
+    const Ops *ops; // nullptr if empty
+};
+
+#endif /* SuperAudioCallback_h */
@@ -0,0 +1,174 @@
+//
+//  SuperAudioLockFree.h
+//
+/****************************************************************************
+ Copyright (c) 2018 David T. Offen
+
+ http://www.doffen.org
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+//  Lock-free containers for passing audio between the audio thread and other threads,
+//    used only by SuperAudio.cpp.  Neither one allocates except in allocate(), and
+//    neither one ever blocks.
+//  Never include any Cocos2d-x or Superpowered include files here.
+
+#ifndef SuperAudioLockFree_h
+#define SuperAudioLockFree_h
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+// Single-producer single-consumer ring of T.  The writer drops what doesn't fit,
+//   rather than waiting for the reader.
+template <typename T>
+class SuperAudioRingBuffer {
+public:
+    SuperAudioRingBuffer() : buffer(nullptr), mask(0), head(0), tail(0) {}
+    ~SuperAudioRingBuffer() { release(); }
+
+    // capacity is rounded up to a power of two; call while neither thread is using it
+    bool allocate(unsigned int capacity) {
+        release();
+        unsigned int size = 1;
+        while (size < capacity) size <<= 1;
+        buffer = (T *)calloc(size, sizeof(T));
+        if (buffer == nullptr) return false;
+        mask = size - 1;
+        head = tail = 0;
+        return true;
+    }
+
+    void release() {
+        free(buffer);
+        buffer = nullptr;
+        mask = 0;
+    }
+
+    unsigned int capacity() const { return buffer ? mask + 1 : 0; }
+
+    unsigned int available() const { // to read
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+
+    unsigned int space() const { // to write
+        return (mask + 1) - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+    }
+
+    // writer only: returns the number written, which is less than count if the ring is full
+    unsigned int write(const T *values, unsigned int count) {
+        auto h = head.load(std::memory_order_relaxed);
+        auto space = (mask + 1) - (h - tail.load(std::memory_order_acquire));
+        if (count > space) count = space;
+        auto start = h & mask, first = (mask + 1) - start;
+        if (first > count) first = count;
+        memcpy(buffer + start, values, first * sizeof(T));
+        memcpy(buffer, values + first, (count - first) * sizeof(T));
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    // reader only: returns the number read
+    unsigned int read(T *values, unsigned int count) {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto ready = head.load(std::memory_order_acquire) - t;
+        if (count > ready) count = ready;
+        auto start = t & mask, first = (mask + 1) - start;
+        if (first > count) first = count;
+        memcpy(values, buffer + start, first * sizeof(T));
+        memcpy(values + first, buffer, (count - first) * sizeof(T));
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    // reader only: skips everything written so far
+    void discard() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    T *buffer;
+    unsigned int mask;
+    std::atomic<unsigned int> head; // total written (wraps)
+    std::atomic<unsigned int> tail; // total read (wraps)
+};
+
+// Double-buffered snapshot of count values of T.  A single writer fills the back buffer
+//   and publishes it; readers copy from the front buffer, retrying if a publish overtook them.
+template <typename T>
+class SuperAudioSnapshot {
+public:
+    SuperAudioSnapshot() : count(0), sequence(0) { buffers[0] = buffers[1] = nullptr; }
+    ~SuperAudioSnapshot() { release(); }
+
+    // call while neither thread is using it
+    bool allocate(int valueCount) {
+        release();
+        buffers[0] = (T *)calloc(valueCount, sizeof(T));
+        buffers[1] = (T *)calloc(valueCount, sizeof(T));
+        if (buffers[0] == nullptr || buffers[1] == nullptr) {
+            release();
+            return false;
+        }
+        count = valueCount;
+        sequence = 0;
+        return true;
+    }
+
+    void release() {
+        free(buffers[0]);
+        free(buffers[1]);
+        buffers[0] = buffers[1] = nullptr;
+        count = 0;
+    }
+
+    int size() const { return count; }
+
+    // writer only: the buffer to fill, which readers don't see until publish()
+    T *back() { return buffers[(sequence.load(std::memory_order_relaxed) + 1) & 1]; }
+
+    // writer only: makes back() the front buffer
+    void publish() {
+        sequence.fetch_add(1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // so writes to the next back() stay after this
+    }
+
+    // reader: copies values [first, first+valueCount), returning false if nothing was published yet
+    // (or, very rarely, if the writer kept overtaking the copy)
+    bool read(T *values, int first, int valueCount) const {
+        if (first < 0 || valueCount <= 0 || first + valueCount > count) return false;
+        for (auto tries=0; tries < 4; tries++) {
+            auto s = sequence.load(std::memory_order_acquire);
+            if (s == 0) return false;
+            memcpy(values, buffers[s & 1] + first, valueCount * sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == s) return true;
+        }
+        return false;
+    }
+
+private:
+    T *buffers[2];
+    int count;
+    std::atomic<unsigned int> sequence; // number of publishes; front buffer is buffers[sequence & 1]
+};
+
+#endif /* SuperAudioLockFree_h */
@@ -47,3 +47,12 @@
     scheduler->performFunctionInCocosThread(function);
 }
 
+/*static*/ void SuperAudioUtils::scheduleEveryFrame(void *target, std::function<void()> function) {
+    cocos2d::Scheduler *scheduler = cocos2d::Director::getInstance()->getScheduler();
+    scheduler->schedule([function](float) { function(); }, target, 0, false, "SuperAudioUtils");
+}
+
+/*static*/ void SuperAudioUtils::unscheduleEveryFrame(void *target) {
+    cocos2d::Scheduler *scheduler = cocos2d::Director::getInstance()->getScheduler();
+    scheduler->unschedule("SuperAudioUtils", target);
+}
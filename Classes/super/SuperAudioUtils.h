@@ -39,6 +39,8 @@ class SuperAudioUtils /*: public cocos2d::Node*/ {
 public:
     static std::string fullPathForFilename(const std::string &filename);
     static void useCocosThread(std::function<void()> function);
+    static void scheduleEveryFrame(void *target, std::function<void()> function); // in Cocos thread
+    static void unscheduleEveryFrame(void *target);
     
 private:
     SuperAudioUtils() {};